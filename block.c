@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "block.h"
+#include "mmio.h"
+#include "riscv.h"
+#include "superblock.h"
+
+struct Block {
+    Byte *data; /* sectors * BLOCK_SECTOR_SIZE bytes, NULL if empty */
+    size_t mapped;
+    Word sectors;
+    int writable;
+    /* the descriptor and the status of the last command */
+    Word sector;
+    Address address;
+    Word count;
+    Word status;
+    /* the request queue, in guest memory */
+    Address queue;
+    Word queue_size;
+};
+
+Block *block_open(const char *path, int copy_on_write) {
+    Block *b = calloc(1, sizeof(Block));
+    struct stat st;
+    int fd;
+
+    if (b == NULL) {
+        return NULL;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        (Double)st.st_size > (Double)UINT32_MAX * BLOCK_SECTOR_SIZE) {
+        goto fail;
+    }
+    b->sectors = (st.st_size + BLOCK_SECTOR_SIZE - 1) >> BLOCK_SECTOR_SHIFT;
+    b->writable = copy_on_write;
+    if (b->sectors > 0) {
+        // a sector never crosses a page, so the partial one is mapped whole
+        b->mapped = (size_t)b->sectors << BLOCK_SECTOR_SHIFT;
+        b->data = mmap(NULL, b->mapped,
+                       PROT_READ | (copy_on_write ? PROT_WRITE : 0),
+                       MAP_PRIVATE, fd, 0);
+        if (b->data == MAP_FAILED) {
+            goto fail;
+        }
+    }
+    close(fd);
+    return b;
+
+fail:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(b);
+    return NULL;
+}
+
+void block_close(Block *b) {
+    if (b) {
+        if (b->data) {
+            munmap(b->data, b->mapped);
+        }
+        free(b);
+    }
+}
+
+Word block_sectors(const Block *b) {
+    return b->sectors;
+}
+
+/* Returns 0 if the guest range is outside memory, otherwise sets status */
+static int transfer(Block *b, Processor *p, Byte *memory, Word sector,
+                    Address address, Word count, Word command) {
+    Double bytes = (Double)count << BLOCK_SECTOR_SHIFT;
+    Byte *sectors;
+
+    if (command != BLOCK_READ && command != BLOCK_WRITE) {
+        b->status = BLOCK_ERROR_COMMAND;
+        return 1;
+    }
+    if (!in_memory(address, bytes)) {
+        return 0;
+    }
+    if (sector > b->sectors || count > b->sectors - sector) {
+        b->status = BLOCK_ERROR_RANGE;
+    } else if (command == BLOCK_WRITE && !b->writable) {
+        b->status = BLOCK_ERROR_READONLY;
+    } else {
+        b->status = BLOCK_OK;
+    }
+    if (b->status != BLOCK_OK || bytes == 0) {
+        return 1;
+    }
+    sectors = b->data + ((size_t)sector << BLOCK_SECTOR_SHIFT);
+    if (command == BLOCK_READ) {
+        memcpy(memory + address, sectors, bytes);
+        memory_dirty(memory, address, bytes);
+        // the sectors may land on code that superblocks were formed from
+        sb_check_range(p->sb, address, bytes);
+    } else {
+        memcpy(sectors, memory + address, bytes);
+    }
+    return 1;
+}
+
+static Word get_queue_word(Byte *memory, Address address) {
+    return load(memory, address, LENGTH_WORD);
+}
+
+static void put_queue_word(Processor *p, Byte *memory, Address address,
+                           Word value) {
+    store(memory, address, LENGTH_WORD, value);
+    sb_check_store(p->sb, address, LENGTH_WORD);
+}
+
+/* The doorbell: runs every request posted since the last one completed.
+   Returns 0 if the queue or a request's memory is outside guest memory. */
+static int run_queue(Block *b, Processor *p, Byte *memory) {
+    Double bytes = BLOCK_QUEUE_REQUESTS +
+                   (Double)b->queue_size * BLOCK_REQUEST_SIZE;
+    Word avail, used;
+
+    if (b->queue_size == 0 || !in_memory(b->queue, bytes) ||
+        (b->queue & 3)) {
+        return 0;
+    }
+    avail = get_queue_word(memory, b->queue + BLOCK_QUEUE_AVAIL);
+    used = get_queue_word(memory, b->queue + BLOCK_QUEUE_USED);
+    if (avail - used > b->queue_size) {
+        return 0;
+    }
+    for (; used != avail; used++) {
+        Address slot = b->queue + BLOCK_QUEUE_REQUESTS +
+                       (used & (b->queue_size - 1)) * BLOCK_REQUEST_SIZE;
+
+        if (!transfer(b, p, memory,
+                      get_queue_word(memory, slot + BLOCK_REQUEST_SECTOR),
+                      get_queue_word(memory, slot + BLOCK_REQUEST_ADDRESS),
+                      get_queue_word(memory, slot + BLOCK_REQUEST_COUNT),
+                      get_queue_word(memory, slot + BLOCK_REQUEST_COMMAND))) {
+            return 0;
+        }
+        put_queue_word(p, memory, slot + BLOCK_REQUEST_STATUS, b->status);
+        put_queue_word(p, memory, b->queue + BLOCK_QUEUE_USED, used + 1);
+    }
+    return 1;
+}
+
+int block_load(void *context, Processor *p, Byte *memory, Word offset,
+               Alignment length, Double instret, Word *value) {
+    const Block *b = context;
+    Word word;
+
+    if ((offset & 3) + length > 4) {
+        return 0;
+    }
+    switch (offset & ~3U) {
+        case BLOCK_SECTOR: word = b->sector; break;
+        case BLOCK_ADDRESS: word = b->address; break;
+        case BLOCK_COUNT: word = b->count; break;
+        case BLOCK_COMMAND: word = 0; break;
+        case BLOCK_STATUS: word = b->status; break;
+        case BLOCK_SECTORS: word = b->sectors; break;
+        case BLOCK_QUEUE: word = b->queue; break;
+        case BLOCK_QUEUE_SIZE: word = b->queue_size; break;
+        case BLOCK_NOTIFY: word = 0; break;
+        default: return 0;
+    }
+    *value = mmio_extend(word >> (offset & 3) * 8, length);
+    return 1;
+}
+
+int block_store(void *context, Processor *p, Byte *memory, Word offset,
+                Alignment length, Double instret, Word value) {
+    Block *b = context;
+
+    if (length != LENGTH_WORD) {
+        return 0;
+    }
+    switch (offset) {
+        case BLOCK_SECTOR: b->sector = value; break;
+        case BLOCK_ADDRESS: b->address = value; break;
+        case BLOCK_COUNT: b->count = value; break;
+        case BLOCK_COMMAND:
+            return transfer(b, p, memory, b->sector, b->address, b->count,
+                            value);
+        case BLOCK_QUEUE: b->queue = value; break;
+        case BLOCK_QUEUE_SIZE:
+            // a power of two, so indices wrap with a mask
+            if (value > BLOCK_QUEUE_MAX || (value & (value - 1))) {
+                return 0;
+            }
+            b->queue_size = value;
+            break;
+        case BLOCK_NOTIFY: return run_queue(b, p, memory);
+        default: return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,87 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "types.h"
+
+/* A block device whose sectors are a host file mapped into the emulator
+   (-D, -W), so that a guest reads its data set in place instead of having
+   it encoded into the program. A transfer is a descriptor written to the
+   device's registers (mmio.h): the first sector, the guest address and the
+   number of sectors, then a command, which moves all of them with one
+   memcpy. ECALL_BLOCK_READ and ECALL_BLOCK_WRITE issue the same descriptor
+   from a1 (guest address), a2 (sector) and a3 (count) and return the
+   status in a0.
+
+   Requests can also be queued, virtio style, in a ring in guest memory:
+     +0  avail  requests posted, counting up forever (written by the guest)
+     +4  used   requests completed, likewise (written by the device)
+     +8  queue size requests of BLOCK_REQUEST_SIZE bytes each: sector,
+         address, count, command and the status the device writes back
+   Request n is in slot n mod size. The guest fills slots, advances avail
+   and writes the NOTIFY doorbell once; the device runs everything from
+   used up to avail before the store retires, so there is no interrupt and
+   used is already caught up when the guest next looks.
+
+   The file is mapped privately: read-only, or copy-on-write, in which case
+   the guest may write sectors but the file itself never changes. A file
+   whose size is not a whole number of sectors ends in a partial sector
+   that reads as zeros past the end of the file. Transfers bypass the
+   processor, so the -m memory trace does not show the sectors they move. */
+
+#define BLOCK_SECTOR_SHIFT 9
+#define BLOCK_SECTOR_SIZE (1U << BLOCK_SECTOR_SHIFT)
+
+/* Register offsets from BLOCK_BASE. The descriptor registers are written
+   as words, and every register reads at any width. */
+#define BLOCK_BASE 0x10002000
+#define BLOCK_SIZE 0x24
+#define BLOCK_SECTOR 0x0
+#define BLOCK_ADDRESS 0x4
+#define BLOCK_COUNT 0x8
+#define BLOCK_COMMAND 0xC
+#define BLOCK_STATUS 0x10  /* of the last command */
+#define BLOCK_SECTORS 0x14 /* capacity, read-only */
+#define BLOCK_QUEUE 0x18      /* guest address of the queue, word aligned */
+#define BLOCK_QUEUE_SIZE 0x1C /* slots, a power of two; 0 until set */
+#define BLOCK_NOTIFY 0x20     /* doorbell; any value */
+
+#define BLOCK_QUEUE_MAX 256 /* slots */
+#define BLOCK_QUEUE_AVAIL 0x0
+#define BLOCK_QUEUE_USED 0x4
+#define BLOCK_QUEUE_REQUESTS 0x8
+#define BLOCK_REQUEST_SECTOR 0x0
+#define BLOCK_REQUEST_ADDRESS 0x4
+#define BLOCK_REQUEST_COUNT 0x8
+#define BLOCK_REQUEST_COMMAND 0xC
+#define BLOCK_REQUEST_STATUS 0x10
+#define BLOCK_REQUEST_SIZE 0x14
+
+#define BLOCK_READ 1  /* device to guest memory */
+#define BLOCK_WRITE 2 /* guest memory to device */
+
+/* A command whose guest memory range is not inside memory is rejected
+   like any bad device access, and halts the machine with
+   MACHINE_ACCESS_FAULT; so is a doorbell whose queue is unset, outside
+   memory or claims more than size requests outstanding. Anything else
+   completes with a status, which STATUS also holds for the last request
+   a doorbell ran. */
+#define BLOCK_OK 0
+#define BLOCK_ERROR_RANGE 1    /* sectors past the end of the device */
+#define BLOCK_ERROR_READONLY 2 /* a write to a read-only device */
+#define BLOCK_ERROR_COMMAND 3  /* no such command */
+
+typedef struct Block Block;
+
+/* Maps path; returns NULL if it cannot be opened or mapped */
+Block *block_open(const char *path, int copy_on_write);
+void block_close(Block *);
+
+Word block_sectors(const Block *);
+
+/* MmioDevice callbacks; context is a Block */
+int block_load(void *, Processor *, Byte *, Word offset, Alignment,
+               Double instret, Word *value);
+int block_store(void *, Processor *, Byte *, Word offset, Alignment,
+                Double instret, Word value);
+
+#endif
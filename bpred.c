@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bpred.h"
+
+/* All predictor state lives in fixed-size tables inside the BranchPredictor,
+   so recording a branch never allocates. */
+
+#define BIMODAL_BITS 12
+#define GSHARE_BITS 14
+#define TAGE_BASE_BITS 12
+#define TAGE_TABLES 4
+#define TAGE_BITS 10
+#define TAGE_TAG_BITS 9
+#define TAGE_USEFUL_RESET (1U << 18)
+#define BTB_BITS 10
+#define RAS_DEPTH 16
+#define STATS_BITS 12
+#define STATS_PROBES 16
+
+#define PC_INDEX(pc, bits) (((pc) >> 2) & ((1U << (bits)) - 1))
+
+/* 2-bit saturating counters: 0,1 predict not taken; 2,3 predict taken */
+static inline uint8_t counter_update(uint8_t ctr, int taken) {
+    if (taken) {
+        return ctr < 3 ? ctr + 1 : 3;
+    }
+    return ctr > 0 ? ctr - 1 : 0;
+}
+
+typedef struct {
+    uint8_t ctr[1U << BIMODAL_BITS];
+} Bimodal;
+
+typedef struct {
+    uint8_t ctr[1U << GSHARE_BITS];
+    Word history;
+} Gshare;
+
+typedef struct {
+    uint16_t tag;
+    uint8_t ctr;    /* 3-bit, >= 4 predicts taken */
+    uint8_t useful; /* 2-bit */
+} TageEntry;
+
+typedef struct {
+    uint8_t base[1U << TAGE_BASE_BITS];
+    TageEntry table[TAGE_TABLES][1U << TAGE_BITS];
+    Double history;
+    Word branches;
+    /* lookup state carried from predict() to update() */
+    Word index[TAGE_TABLES];
+    uint16_t tag[TAGE_TABLES];
+    int provider;
+    int alt_taken;
+    int provider_taken;
+} Tage;
+
+typedef struct {
+    Address pc;
+    Address target;
+    uint8_t ctr;
+    uint8_t valid;
+} BtbEntry;
+
+typedef struct {
+    BtbEntry btb[1U << BTB_BITS];
+    Address ras[RAS_DEPTH];
+    unsigned ras_top; /* wraps; overflow overwrites the oldest entry */
+} BtbRas;
+
+typedef struct {
+    Address pc;
+    uint8_t kind;
+    uint8_t used;
+    Double executed;
+    Double taken;
+    Double mispredicted;
+} BranchStats;
+
+struct BranchPredictor {
+    const BranchPredictorOps *ops;
+    union {
+        Bimodal bimodal;
+        Gshare gshare;
+        Tage tage;
+        BtbRas btb;
+    } state;
+    BranchStats stats[1U << STATS_BITS];
+    Double untracked; /* executions of branches with no stats slot */
+    Double executed;
+    Double mispredicted;
+};
+
+/* ---- bimodal ---- */
+
+static void bimodal_reset(void *s) {
+    Bimodal *b = s;
+    memset(b->ctr, 1, sizeof(b->ctr));
+}
+
+static BranchPrediction bimodal_predict(void *s, Address pc, BranchKind kind) {
+    Bimodal *b = s;
+    BranchPrediction p = {1, 0, 0};
+    if (kind == BRANCH_CONDITIONAL) {
+        p.taken = b->ctr[PC_INDEX(pc, BIMODAL_BITS)] >= 2;
+    }
+    return p;
+}
+
+static void bimodal_update(void *s, Address pc, BranchKind kind, int taken,
+                           Address target) {
+    Bimodal *b = s;
+    if (kind == BRANCH_CONDITIONAL) {
+        uint8_t *ctr = &b->ctr[PC_INDEX(pc, BIMODAL_BITS)];
+        *ctr = counter_update(*ctr, taken);
+    }
+}
+
+/* ---- gshare ---- */
+
+static void gshare_reset(void *s) {
+    Gshare *g = s;
+    memset(g->ctr, 1, sizeof(g->ctr));
+    g->history = 0;
+}
+
+static inline Word gshare_index(Gshare *g, Address pc) {
+    return ((pc >> 2) ^ g->history) & ((1U << GSHARE_BITS) - 1);
+}
+
+static BranchPrediction gshare_predict(void *s, Address pc, BranchKind kind) {
+    Gshare *g = s;
+    BranchPrediction p = {1, 0, 0};
+    if (kind == BRANCH_CONDITIONAL) {
+        p.taken = g->ctr[gshare_index(g, pc)] >= 2;
+    }
+    return p;
+}
+
+static void gshare_update(void *s, Address pc, BranchKind kind, int taken,
+                          Address target) {
+    Gshare *g = s;
+    if (kind == BRANCH_CONDITIONAL) {
+        uint8_t *ctr = &g->ctr[gshare_index(g, pc)];
+        *ctr = counter_update(*ctr, taken);
+        g->history = ((g->history << 1) | (taken ? 1 : 0)) &
+                     ((1U << GSHARE_BITS) - 1);
+    }
+}
+
+/* ---- TAGE-lite: bimodal base plus tagged tables on geometric histories ---- */
+
+static const int tage_history_length[TAGE_TABLES] = {5, 11, 22, 44};
+
+/* Fold the newest len history bits down to bits wide */
+static inline Word fold_history(Double history, int len, int bits) {
+    Double h = len < 64 ? history & ((1ULL << len) - 1) : history;
+    Word folded = 0;
+    while (h) {
+        folded ^= (Word)(h & ((1U << bits) - 1));
+        h >>= bits;
+    }
+    return folded;
+}
+
+static void tage_reset(void *s) {
+    Tage *t = s;
+    memset(t, 0, sizeof(*t));
+    memset(t->base, 1, sizeof(t->base));
+}
+
+static BranchPrediction tage_predict(void *s, Address pc, BranchKind kind) {
+    Tage *t = s;
+    BranchPrediction p = {1, 0, 0};
+    int i, alt = -1;
+
+    if (kind != BRANCH_CONDITIONAL) {
+        return p;
+    }
+
+    t->provider = -1;
+    for (i = 0; i < TAGE_TABLES; i++) {
+        int len = tage_history_length[i];
+        t->index[i] = ((pc >> 2) ^ fold_history(t->history, len, TAGE_BITS)) &
+                      ((1U << TAGE_BITS) - 1);
+        t->tag[i] = ((pc >> 2) ^ fold_history(t->history, len, TAGE_TAG_BITS) ^
+                     (pc >> (2 + TAGE_BITS))) &
+                    ((1U << TAGE_TAG_BITS) - 1);
+    }
+    for (i = TAGE_TABLES - 1; i >= 0; i--) {
+        if (t->table[i][t->index[i]].tag == t->tag[i]) {
+            if (t->provider < 0) {
+                t->provider = i;
+            } else {
+                alt = i;
+                break;
+            }
+        }
+    }
+
+    t->alt_taken = alt >= 0 ? t->table[alt][t->index[alt]].ctr >= 4
+                            : t->base[PC_INDEX(pc, TAGE_BASE_BITS)] >= 2;
+    t->provider_taken = t->provider >= 0
+                            ? t->table[t->provider][t->index[t->provider]].ctr >= 4
+                            : t->alt_taken;
+    p.taken = t->provider_taken;
+    return p;
+}
+
+static void tage_update(void *s, Address pc, BranchKind kind, int taken,
+                        Address target) {
+    Tage *t = s;
+    int i;
+
+    if (kind != BRANCH_CONDITIONAL) {
+        return;
+    }
+
+    if (t->provider >= 0) {
+        TageEntry *e = &t->table[t->provider][t->index[t->provider]];
+        if (taken && e->ctr < 7) {
+            e->ctr++;
+        } else if (!taken && e->ctr > 0) {
+            e->ctr--;
+        }
+        if (t->provider_taken != t->alt_taken) {
+            if (t->provider_taken == taken && e->useful < 3) {
+                e->useful++;
+            } else if (t->provider_taken != taken && e->useful > 0) {
+                e->useful--;
+            }
+        }
+    } else {
+        uint8_t *ctr = &t->base[PC_INDEX(pc, TAGE_BASE_BITS)];
+        *ctr = counter_update(*ctr, taken);
+    }
+
+    /* on a mispredict, allocate in a longer-history table */
+    if (t->provider_taken != taken) {
+        int allocated = 0;
+        for (i = t->provider + 1; i < TAGE_TABLES; i++) {
+            TageEntry *e = &t->table[i][t->index[i]];
+            if (e->useful == 0) {
+                e->tag = t->tag[i];
+                e->ctr = taken ? 4 : 3;
+                allocated = 1;
+                break;
+            }
+        }
+        if (!allocated) {
+            for (i = t->provider + 1; i < TAGE_TABLES; i++) {
+                TageEntry *e = &t->table[i][t->index[i]];
+                if (e->useful > 0) {
+                    e->useful--;
+                }
+            }
+        }
+    }
+
+    /* periodically age useful bits so stale entries can be replaced */
+    if (++t->branches % TAGE_USEFUL_RESET == 0) {
+        int j;
+        for (i = 0; i < TAGE_TABLES; i++) {
+            for (j = 0; j < (1 << TAGE_BITS); j++) {
+                t->table[i][j].useful >>= 1;
+            }
+        }
+    }
+
+    t->history = (t->history << 1) | (taken ? 1 : 0);
+}
+
+/* ---- BTB + return address stack: a BTB hit predicts taken ---- */
+
+static void btb_reset(void *s) {
+    BtbRas *b = s;
+    memset(b, 0, sizeof(*b));
+}
+
+static BranchPrediction btb_predict(void *s, Address pc, BranchKind kind) {
+    BtbRas *b = s;
+    BranchPrediction p = {0, 0, 0};
+    BtbEntry *e = &b->btb[PC_INDEX(pc, BTB_BITS)];
+
+    if (kind == BRANCH_RETURN) {
+        p.taken = 1;
+        p.has_target = 1;
+        p.target = b->ras[(b->ras_top - 1) % RAS_DEPTH];
+        return p;
+    }
+    if (e->valid && e->pc == pc) {
+        p.taken = kind != BRANCH_CONDITIONAL || e->ctr >= 2;
+        p.has_target = p.taken;
+        p.target = e->target;
+    }
+    return p;
+}
+
+static void btb_update(void *s, Address pc, BranchKind kind, int taken,
+                       Address target) {
+    BtbRas *b = s;
+    BtbEntry *e = &b->btb[PC_INDEX(pc, BTB_BITS)];
+
+    if (kind == BRANCH_RETURN) {
+        b->ras_top--;
+        return;
+    }
+    if (kind == BRANCH_CALL) {
+        b->ras[b->ras_top % RAS_DEPTH] = pc + 4;
+        b->ras_top++;
+    }
+    if (e->valid && e->pc == pc) {
+        e->ctr = counter_update(e->ctr, taken);
+        if (taken) {
+            e->target = target;
+        }
+    } else if (taken) {
+        e->valid = 1;
+        e->pc = pc;
+        e->target = target;
+        e->ctr = 2;
+    }
+}
+
+static const BranchPredictorOps predictors[] = {
+    {"bimodal", bimodal_reset, bimodal_predict, bimodal_update},
+    {"gshare", gshare_reset, gshare_predict, gshare_update},
+    {"tage", tage_reset, tage_predict, tage_update},
+    {"btb", btb_reset, btb_predict, btb_update},
+};
+
+const char *bpred_names = "bimodal, gshare, tage, btb";
+
+BranchPredictor *bpred_create(const char *name) {
+    size_t i;
+    for (i = 0; i < sizeof(predictors) / sizeof(predictors[0]); i++) {
+        if (strcmp(name, predictors[i].name) == 0) {
+            BranchPredictor *bp = calloc(1, sizeof(BranchPredictor));
+            if (bp == NULL) {
+                return NULL;
+            }
+            bp->ops = &predictors[i];
+            bp->ops->reset(&bp->state);
+            return bp;
+        }
+    }
+    return NULL;
+}
+
+void bpred_destroy(BranchPredictor *bp) {
+    free(bp);
+}
+
+/* Open-addressed lookup. A branch is only ever placed within STATS_PROBES
+   slots of its home slot, so finding it never takes more probes, full
+   table or not; returns NULL if all of those belong to other branches. */
+static BranchStats *stats_slot(BranchPredictor *bp, Address pc) {
+    Word mask = (1U << STATS_BITS) - 1;
+    Word i = PC_INDEX(pc, STATS_BITS);
+    Word probes;
+
+    for (probes = 0; probes < STATS_PROBES; probes++, i = (i + 1) & mask) {
+        BranchStats *s = &bp->stats[i];
+        if (!s->used) {
+            s->used = 1;
+            s->pc = pc;
+            return s;
+        }
+        if (s->pc == pc) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+void bpred_record(BranchPredictor *bp, Address pc, BranchKind kind, int taken,
+                  Address target) {
+    BranchPrediction p = bp->ops->predict(&bp->state, pc, kind);
+    int miss = p.taken != taken ||
+               (taken && p.has_target && p.target != target);
+    BranchStats *s;
+
+    bp->ops->update(&bp->state, pc, kind, taken, target);
+
+    bp->executed++;
+    bp->mispredicted += miss;
+
+    s = stats_slot(bp, pc);
+    if (s == NULL) {
+        bp->untracked++;
+        return;
+    }
+    s->kind = kind;
+    s->executed++;
+    s->taken += taken;
+    s->mispredicted += miss;
+}
+
+static int compare_mispredicts(const void *a, const void *b) {
+    const BranchStats *x = a, *y = b;
+    if (x->mispredicted != y->mispredicted) {
+        return x->mispredicted < y->mispredicted ? 1 : -1;
+    }
+    if (x->executed != y->executed) {
+        return x->executed < y->executed ? 1 : -1;
+    }
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+static const char *kind_name(BranchKind kind) {
+    switch (kind) {
+        case BRANCH_CONDITIONAL:
+            return "cond";
+        case BRANCH_JUMP:
+            return "jump";
+        case BRANCH_CALL:
+            return "call";
+        case BRANCH_RETURN:
+            return "ret";
+    }
+    return "?";
+}
+
+void bpred_report(BranchPredictor *bp, FILE *out) {
+    size_t i, n = 0;
+
+    /* compact used entries to the front, then sort by mispredicts */
+    for (i = 0; i < (1U << STATS_BITS); i++) {
+        if (bp->stats[i].used) {
+            bp->stats[n++] = bp->stats[i];
+        }
+    }
+    memset(&bp->stats[n], 0, ((1U << STATS_BITS) - n) * sizeof(BranchStats));
+    qsort(bp->stats, n, sizeof(BranchStats), compare_mispredicts);
+
+    fprintf(out, "branch predictor: %s\n", bp->ops->name);
+    fprintf(out, "branches: %llu  mispredicted: %llu  accuracy: %.2f%%\n",
+            (unsigned long long)bp->executed,
+            (unsigned long long)bp->mispredicted,
+            bp->executed ? 100.0 * (bp->executed - bp->mispredicted) / bp->executed
+                         : 100.0);
+    if (bp->untracked) {
+        fprintf(out, "untracked (no stats slot): %llu\n",
+                (unsigned long long)bp->untracked);
+    }
+    fprintf(out, "%-10s %-5s %12s %12s %12s %8s\n", "pc", "kind", "executed",
+            "taken", "mispredict", "acc%");
+    for (i = 0; i < n; i++) {
+        BranchStats *s = &bp->stats[i];
+        fprintf(out, "%08x   %-5s %12llu %12llu %12llu %8.2f\n", s->pc,
+                kind_name(s->kind), (unsigned long long)s->executed,
+                (unsigned long long)s->taken,
+                (unsigned long long)s->mispredicted,
+                100.0 * (s->executed - s->mispredicted) / s->executed);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Kinds of control transfer reported to a predictor. This ISA subset has no
+   jalr, so BRANCH_RETURN is never produced by the emulator today; the RAS
+   still tracks calls so it is ready once indirect jumps exist. */
+typedef enum {
+    BRANCH_CONDITIONAL,
+    BRANCH_JUMP,
+    BRANCH_CALL,
+    BRANCH_RETURN,
+} BranchKind;
+
+typedef struct {
+    int taken;
+    int has_target; /* predictor supplies a fetch target (BTB/RAS) */
+    Address target;
+} BranchPrediction;
+
+/* A pluggable predictor. predict() is always followed by update() for the
+   same branch, so predictors may keep lookup state between the two calls. */
+typedef struct {
+    const char *name;
+    void (*reset)(void *state);
+    BranchPrediction (*predict)(void *state, Address pc, BranchKind kind);
+    void (*update)(void *state, Address pc, BranchKind kind, int taken,
+                   Address target);
+} BranchPredictorOps;
+
+typedef struct BranchPredictor BranchPredictor;
+
+/* Returns NULL if name is not one of bpred_names */
+BranchPredictor *bpred_create(const char *name);
+void bpred_destroy(BranchPredictor *);
+
+/* Called by execute_branch/execute_jal with the resolved outcome */
+void bpred_record(BranchPredictor *, Address pc, BranchKind kind, int taken,
+                  Address target);
+
+/* Summary plus the per-static-branch accuracy table. Meant to be called
+   once at exit: it reorders the stats table in place. */
+void bpred_report(BranchPredictor *, FILE *out);
+
+extern const char *bpred_names;
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "utils.h"
+#include "riscv.h"
+#include "isa.h"
+
+#define BIT_TEST(map, i) ((map)[(i) >> 6] >> ((i) & 63) & 1)
+#define BIT_SET(map, i) ((map)[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+
+/* Sets *target and returns the block kind for a control transfer, or
+   CFG_FALLTHROUGH for anything else. Invalid branch funct3s fall through,
+   as they do when executed. */
+static int transfer(Word w, Address pc, Address *target) {
+    switch (isa_decode(w)) {
+        case ISA_BEQ:
+        case ISA_BNE:
+            *target = pc + isa_imm_b(w);
+            return CFG_BRANCH;
+        case ISA_JAL:
+            *target = pc + isa_imm_j(w);
+            return CFG_JUMP;
+        default:
+            return CFG_FALLTHROUGH;
+    }
+}
+
+static int inside(const ControlFlowGraph *cfg, Address address) {
+    return address >= cfg->base && ((address - cfg->base) & 3) == 0 &&
+           (address - cfg->base) / 4 < cfg->count;
+}
+
+ControlFlowGraph *cfg_build(const Word *words, size_t count, Address base) {
+    ControlFlowGraph *cfg = calloc(1, sizeof(ControlFlowGraph));
+    uint64_t *is_target, *is_leader;
+    size_t i, words64, nleaders = 0;
+
+    if (cfg == NULL) {
+        return NULL;
+    }
+    cfg->base = base;
+    for (i = 0; i < count && is_valid_opcode(words[i] & 0x7F); i++)
+        ;
+    cfg->count = count = i;
+
+    words64 = count / 64 + 1;
+    is_target = calloc(words64, sizeof(uint64_t));
+    is_leader = calloc(words64, sizeof(uint64_t));
+    if (is_target == NULL || is_leader == NULL) {
+        goto fail;
+    }
+
+    // pass 1: mark targets and the leaders they and control transfers imply
+    if (count > 0) {
+        BIT_SET(is_leader, 0);
+    }
+    for (i = 0; i < count; i++) {
+        Address target;
+        if (transfer(words[i], base + i * 4, &target) == CFG_FALLTHROUGH) {
+            continue;
+        }
+        if (inside(cfg, target)) {
+            BIT_SET(is_target, (target - base) / 4);
+            BIT_SET(is_leader, (target - base) / 4);
+        }
+        if (i + 1 < count) {
+            BIT_SET(is_leader, i + 1);
+        }
+    }
+
+    // pass 2: the bitmaps, read in order, are the sorted arrays
+    for (i = 0; i < count; i++) {
+        cfg->ntargets += BIT_TEST(is_target, i);
+        nleaders += BIT_TEST(is_leader, i);
+    }
+    cfg->targets = malloc((cfg->ntargets + 1) * sizeof(Address));
+    cfg->blocks = malloc((nleaders + 1) * sizeof(BasicBlock));
+    if (cfg->targets == NULL || cfg->blocks == NULL) {
+        goto fail;
+    }
+    cfg->ntargets = 0;
+    for (i = 0; i < count; i++) {
+        if (BIT_TEST(is_target, i)) {
+            cfg->targets[cfg->ntargets++] = base + i * 4;
+        }
+        if (BIT_TEST(is_leader, i)) {
+            BasicBlock *block = &cfg->blocks[cfg->nblocks++];
+            block->start = base + i * 4;
+            block->target = 0;
+            block->target_inside = 0;
+        }
+        if (i + 1 == count || BIT_TEST(is_leader, i + 1)) {
+            BasicBlock *block = &cfg->blocks[cfg->nblocks - 1];
+            block->end = base + (i + 1) * 4;
+            block->kind = transfer(words[i], base + i * 4, &block->target);
+            if (block->kind != CFG_FALLTHROUGH) {
+                block->target_inside = inside(cfg, block->target);
+            } else if (i + 1 == count) {
+                block->kind = CFG_END;
+            }
+        }
+    }
+
+    free(is_target);
+    free(is_leader);
+    return cfg;
+
+fail:
+    free(is_target);
+    free(is_leader);
+    cfg_free(cfg);
+    return NULL;
+}
+
+void cfg_free(ControlFlowGraph *cfg) {
+    if (cfg) {
+        free(cfg->targets);
+        free(cfg->blocks);
+        free(cfg);
+    }
+}
+
+/* Successor start addresses of a block; returns how many there are */
+static int successors(const ControlFlowGraph *cfg, const BasicBlock *block,
+                      Address out[2]) {
+    int n = 0;
+
+    if (block->kind != CFG_FALLTHROUGH && block->kind != CFG_END &&
+        block->target_inside) {
+        out[n++] = block->target;
+    }
+    if ((block->kind == CFG_FALLTHROUGH || block->kind == CFG_BRANCH) &&
+        inside(cfg, block->end)) {
+        out[n++] = block->end;
+    }
+    return n;
+}
+
+void cfg_write_dot(const ControlFlowGraph *cfg, FILE *file) {
+    size_t i;
+
+    fprintf(file, "digraph cfg {\n");
+    fprintf(file, "    node [shape=box, fontname=monospace];\n");
+    for (i = 0; i < cfg->nblocks; i++) {
+        const BasicBlock *block = &cfg->blocks[i];
+        Address next[2];
+        int j, n = successors(cfg, block, next);
+
+        fprintf(file, "    L_%08x [label=\"L_%08x\\n%u instructions\"];\n",
+                block->start, block->start, (block->end - block->start) / 4);
+        for (j = 0; j < n; j++) {
+            const char *label = block->kind == CFG_BRANCH
+                                    ? (next[j] == block->end ? "not taken" : "taken")
+                                    : block->kind == CFG_JUMP ? "jal" : "";
+            fprintf(file, "    L_%08x -> L_%08x [label=\"%s\"%s];\n",
+                    block->start, next[j], label,
+                    next[j] <= block->start ? ", style=bold" : "");
+        }
+    }
+    fprintf(file, "}\n");
+}
+
+void cfg_write_json(const ControlFlowGraph *cfg, FILE *file) {
+    static const char *kinds[] = {"fallthrough", "branch", "jump", "end"};
+    size_t i;
+
+    fprintf(file, "{\"base\": %u, \"instructions\": %zu, \"targets\": [",
+            cfg->base, cfg->count);
+    for (i = 0; i < cfg->ntargets; i++) {
+        fprintf(file, "%s%u", i ? ", " : "", cfg->targets[i]);
+    }
+    fprintf(file, "],\n \"blocks\": [\n");
+    for (i = 0; i < cfg->nblocks; i++) {
+        const BasicBlock *block = &cfg->blocks[i];
+        Address next[2];
+        int j, n = successors(cfg, block, next);
+
+        fprintf(file, "  {\"start\": %u, \"end\": %u, \"instructions\": %u, "
+                      "\"kind\": \"%s\", \"successors\": [",
+                block->start, block->end, (block->end - block->start) / 4,
+                kinds[block->kind]);
+        for (j = 0; j < n; j++) {
+            fprintf(file, "%s%u", j ? ", " : "", next[j]);
+        }
+        fprintf(file, "]}%s\n", i + 1 < cfg->nblocks ? "," : "");
+    }
+    fprintf(file, "]}\n");
+}
+
+int disassemble_symbolic(const ControlFlowGraph *cfg, const Word *words,
+                         size_t count, FILE *file) {
+    char buffer[DISASM_BATCH * DISASM_MAX_LINE]; // on the stack, not shared
+    size_t i, j, n, label = 0;
+    int stopped = 0;
+
+    for (i = 0; i < count && !stopped; i += n) {
+        char *line = buffer, *end;
+
+        n = count - i < DISASM_BATCH ? count - i : DISASM_BATCH;
+        end = buffer + disassemble_block(words + i, n, cfg->base + i * 4,
+                                         buffer, &stopped);
+        for (j = 0; line < end; j++) {
+            Address pc = cfg->base + (i + j) * 4;
+            char *eol = memchr(line, '\n', end - line);
+            Address target;
+
+            if (eol == NULL) {
+                // the address of an unknown opcode ends the listing
+                fwrite(line, 1, end - line, file);
+                break;
+            }
+            // targets are sorted, so one cursor walks them with the listing
+            if (label < cfg->ntargets && cfg->targets[label] == pc) {
+                fprintf(file, "L_%08x:\n", pc);
+                label++;
+            }
+            if (transfer(words[i + j], pc, &target) != CFG_FALLTHROUGH &&
+                inside(cfg, target)) {
+                // replace the trailing offset operand with the label
+                char *operand = eol;
+                while (operand[-1] != ' ') {
+                    operand--;
+                }
+                fwrite(line, 1, operand - line, file);
+                fprintf(file, "L_%08x\n", target);
+            } else {
+                fwrite(line, 1, eol + 1 - line, file);
+            }
+            line = eol + 1;
+        }
+    }
+    return stopped ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Static control flow of a loaded image. One linear pass over the words
+   marks every in-image branch and jal destination, plus the instruction
+   after each branch or jump, in a bitmap with one bit per word. Walking the
+   bitmap then yields the targets and the basic block leaders as flat
+   arrays that are already sorted, with no sort and no per-lookup search.
+   An opcode outside the decode table (isa.h) ends the image, since
+   disassembly and execution both stop there. */
+
+/* how a basic block ends */
+#define CFG_FALLTHROUGH 0 /* runs into the next leader */
+#define CFG_BRANCH 1      /* beq/bne: taken and fallthrough edges */
+#define CFG_JUMP 2        /* jal: one edge to the target */
+#define CFG_END 3         /* last block of the image */
+
+typedef struct {
+    Address start;
+    Address end; /* one past the last instruction */
+    Address target; /* branch or jump destination */
+    Byte kind;
+    Byte target_inside; /* is target a block of this image? */
+} BasicBlock;
+
+typedef struct {
+    Address base;
+    size_t count; /* words up to the first unknown opcode */
+    Address *targets; /* sorted, unique, all inside the image */
+    size_t ntargets;
+    BasicBlock *blocks; /* sorted by start */
+    size_t nblocks;
+} ControlFlowGraph;
+
+/* Returns NULL if out of memory */
+ControlFlowGraph *cfg_build(const Word *words, size_t count, Address base);
+void cfg_free(ControlFlowGraph *);
+
+/* Graphviz digraph; back edges (loops, the candidates for hot regions) are
+   drawn bold */
+void cfg_write_dot(const ControlFlowGraph *, FILE *);
+/* {"blocks":[{"start":..,"end":..,"instructions":..,"successors":[..]}]} */
+void cfg_write_json(const ControlFlowGraph *, FILE *);
+
+/* -d output with an "L_xxxxxxxx:" line before every branch or jal target
+   and targets inside the image printed as labels instead of offsets.
+   Returns -1 if the listing was cut short by an unknown opcode. */
+int disassemble_symbolic(const ControlFlowGraph *, const Word *words,
+                         size_t count, FILE *);
+
+#endif
@@ -0,0 +1,512 @@
+#include <stddef.h>
+#include <string.h>
+#include "decode.h"
+#include "utils.h"
+#include "riscv.h"
+#include "bpred.h"
+#include "memtrace.h"
+#include "superblock.h"
+#include "psimd.h"
+#include "vector.h"
+#include "mmio.h"
+#include "isa.h"
+
+/* Handlers mirror the cases of execute_instruction() in emulator.c
+   expression for expression, so decoded and reference execution stay
+   bit-identical. */
+
+#define RD p->R[d->rd]
+#define RS1 p->R[d->rs1]
+#define RS2 p->R[d->rs2]
+
+#define HANDLER(name) \
+    static void name(const DecodedInstruction *d, Processor *p, Byte *memory)
+
+/* Inside a superblock p->instret is behind by the block instructions ahead
+   of this one, d->next; the reference path gets the exact count, which
+   CSR writes, wfi and devices depend on */
+HANDLER(op_fallback) {
+    p->instret += d->next;
+    execute_instruction(d->bits, p, memory);
+    p->instret -= d->next;
+    p->R[0] = 0; // the reference path writes x0 directly
+}
+
+/* R-type */
+HANDLER(op_add) { RD = ((sWord)RS1) + ((sWord)RS2); p->PC += 4; }
+HANDLER(op_mul) { RD = ((sWord)RS1) * ((sWord)RS2); p->PC += 4; }
+HANDLER(op_sub) { RD = ((sWord)RS1) - ((sWord)RS2); p->PC += 4; }
+HANDLER(op_sll) { RD = ((sWord)RS1) << ((sWord)RS2); p->PC += 4; }
+HANDLER(op_mulh) { RD = (sWord)((((sDouble)RS1) * ((sDouble)RS2)) >> 32); p->PC += 4; }
+HANDLER(op_slt) { RD = (((sWord)RS1) < ((sWord)RS2)) ? 1 : 0; p->PC += 4; }
+HANDLER(op_xor) { RD = ((sWord)RS1) ^ ((sWord)RS2); p->PC += 4; }
+HANDLER(op_div) { RD = riscv_div(RS1, RS2); p->PC += 4; }
+HANDLER(op_srl) { RD = ((Word)RS1) >> ((sWord)RS2); p->PC += 4; }
+HANDLER(op_sra) { RD = ((sWord)RS1) >> ((sWord)RS2); p->PC += 4; }
+HANDLER(op_or) { RD = ((sWord)RS1) | ((sWord)RS2); p->PC += 4; }
+HANDLER(op_rem) { RD = riscv_rem(RS1, RS2); p->PC += 4; }
+HANDLER(op_and) { RD = ((sWord)RS1) & ((sWord)RS2); p->PC += 4; }
+
+/* I-type; imm is pre-extended the way the matching emulator.c case uses it */
+HANDLER(op_addi) { RD = ((sWord)RS1) + d->imm; p->PC += 4; }
+HANDLER(op_slli) { RD = ((sWord)RS1) << d->imm; p->PC += 4; }
+HANDLER(op_slti) { RD = ((sWord)RS1) < d->imm ? 1U : 0U; p->PC += 4; }
+HANDLER(op_xori) { RD = ((sWord)RS1) ^ d->imm; p->PC += 4; }
+HANDLER(op_srli) { RD = ((Word)RS1) >> d->imm; p->PC += 4; }
+HANDLER(op_srai) { RD = ((sWord)RS1) >> d->imm; p->PC += 4; }
+HANDLER(op_ori) { RD = ((sWord)RS1) | d->imm; p->PC += 4; }
+HANDLER(op_andi) { RD = ((sWord)RS1) & d->imm; p->PC += 4; }
+
+/* loads; devices and faults outside memory take the reference path */
+HANDLER(op_lb) {
+    Address address = d->imm + (sWord)RS1;
+    if (mmio_outside(address, LENGTH_BYTE)) {
+        op_fallback(d, p, memory);
+        return;
+    }
+    memtrace_access(p, address, LENGTH_BYTE, 0);
+    RD = (int)load(memory, address, LENGTH_BYTE);
+    p->PC += 4;
+}
+
+HANDLER(op_lh) {
+    Address address = d->imm + (sWord)RS1;
+    if (mmio_outside(address, LENGTH_HALF_WORD)) {
+        op_fallback(d, p, memory);
+        return;
+    }
+    memtrace_access(p, address, LENGTH_HALF_WORD, 0);
+    RD = (int)load(memory, address, LENGTH_HALF_WORD);
+    p->PC += 4;
+}
+
+HANDLER(op_lw) {
+    Address address = d->imm + (sWord)RS1;
+    if (mmio_outside(address, LENGTH_WORD)) {
+        op_fallback(d, p, memory);
+        return;
+    }
+    memtrace_access(p, address, LENGTH_WORD, 0);
+    RD = sign_extend_number(load(memory, address, LENGTH_WORD), LENGTH_WORD);
+    p->PC += 4;
+}
+
+/* stores */
+#define STORE_HANDLER(name, alignment)                 \
+    HANDLER(name) {                                    \
+        Address address = d->imm + (sWord)RS1;         \
+        if (mmio_outside(address, alignment)) {        \
+            op_fallback(d, p, memory);                 \
+            return;                                    \
+        }                                              \
+        memtrace_access(p, address, alignment, 1);     \
+        store(memory, address, alignment, (Word)RS2);  \
+        sb_check_store(p->sb, address, alignment);     \
+        p->PC += 4;                                    \
+    }
+
+STORE_HANDLER(op_sb, LENGTH_BYTE)
+STORE_HANDLER(op_sh, LENGTH_HALF_WORD)
+STORE_HANDLER(op_sw, LENGTH_WORD)
+
+/* control transfer */
+HANDLER(op_beq) {
+    int taken = RS1 == RS2;
+    if (p->bpred) {
+        bpred_record(p->bpred, p->PC, BRANCH_CONDITIONAL, taken, p->PC + d->imm);
+    }
+    p->PC += taken ? d->imm : 4;
+}
+
+HANDLER(op_bne) {
+    int taken = RS1 != RS2;
+    if (p->bpred) {
+        bpred_record(p->bpred, p->PC, BRANCH_CONDITIONAL, taken, p->PC + d->imm);
+    }
+    p->PC += taken ? d->imm : 4;
+}
+
+HANDLER(op_jal) {
+    if (p->bpred) {
+        bpred_record(p->bpred, p->PC,
+                     (d->rd == 1 || d->rd == 5) ? BRANCH_CALL : BRANCH_JUMP, 1,
+                     p->PC + d->imm);
+    }
+    RD = p->PC + 4;
+    p->PC += d->imm;
+}
+
+HANDLER(op_lui) { RD = d->imm; p->PC += 4; }
+
+/* Zicsr counter reads; p->instret is only brought up to date at the end of
+   a superblock, so next holds how many block instructions precede this one */
+HANDLER(op_csr) {
+    Register value;
+    read_csr(p, d->imm, p->instret + d->next, &value);
+    RD = value;
+    p->PC += 4;
+}
+
+/* custom */
+HANDLER(op_mac) { RD = ((sWord)RD) + (((sWord)RS1) * ((sWord)RS2)); p->PC += 4; }
+HANDLER(op_acc) { RD = ((sWord)RD) + (((sWord)RS1) + ((sWord)RS2)); p->PC += 4; }
+HANDLER(op_gep) { RD = ((sWord)RS1) + (((sWord)RS2) << 4); p->PC += 4; }
+
+/* packed SIMD: one handler per op, so psimd_execute's switch folds away */
+#define PSIMD_HANDLER(name, op) \
+    HANDLER(name) { RD = psimd_execute(op, RD, RS1, RS2); p->PC += 4; }
+
+PSIMD_HANDLER(op_add8, PSIMD_ADD8)
+PSIMD_HANDLER(op_add16, PSIMD_ADD16)
+PSIMD_HANDLER(op_sub8, PSIMD_SUB8)
+PSIMD_HANDLER(op_sub16, PSIMD_SUB16)
+PSIMD_HANDLER(op_kadd8, PSIMD_KADD8)
+PSIMD_HANDLER(op_kadd16, PSIMD_KADD16)
+PSIMD_HANDLER(op_mac8, PSIMD_MAC8)
+PSIMD_HANDLER(op_mac16, PSIMD_MAC16)
+PSIMD_HANDLER(op_dot8, PSIMD_DOT8)
+PSIMD_HANDLER(op_dot16, PSIMD_DOT16)
+PSIMD_HANDLER(op_min8, PSIMD_MIN8)
+PSIMD_HANDLER(op_min16, PSIMD_MIN16)
+PSIMD_HANDLER(op_max8, PSIMD_MAX8)
+PSIMD_HANDLER(op_max16, PSIMD_MAX16)
+
+/* vector instructions keep their block going; vl and vtype are only known
+   as they run, so everything past the encoding is checked there */
+HANDLER(op_vector) {
+    execute_vector(d->bits, p, memory);
+    p->R[0] = 0; // vsetvl* and vmv.x.s write x0 directly
+}
+
+/* Fused pairs: d is the first instruction and d + 1 the second, which
+   reads the register the first writes. The first result stays in a local
+   and goes straight into the second operation, with one PC update. It is
+   still written back, being architecturally visible, unless the second
+   overwrites the same register (the _into variants, picked by fusion()). */
+#define FUSED_OPERAND(reg, value) ((reg) == d->rd ? (value) : p->R[reg])
+
+/* lui rd, hi; addi rd, rd, lo folds to a single constant */
+HANDLER(fused_lui_addi) { RD = (sWord)d->imm + d[1].imm; p->PC += 8; }
+
+/* addi then a compare-and-branch on its result, e.g. a loop counter */
+#define FUSED_ADDI_BRANCH(name, compare)                                     \
+    HANDLER(name) {                                                          \
+        const DecodedInstruction *b = d + 1;                                 \
+        Word value = ((sWord)RS1) + d->imm;                                  \
+        Address pc = p->PC + 4;                                              \
+        int taken = FUSED_OPERAND(b->rs1, value) compare                     \
+                    FUSED_OPERAND(b->rs2, value);                            \
+        RD = value;                                                          \
+        if (p->bpred) {                                                      \
+            bpred_record(p->bpred, pc, BRANCH_CONDITIONAL, taken,            \
+                         pc + b->imm);                                       \
+        }                                                                    \
+        p->PC = pc + (taken ? b->imm : 4);                                   \
+    }
+
+FUSED_ADDI_BRANCH(fused_addi_bne, !=)
+FUSED_ADDI_BRANCH(fused_addi_beq, ==)
+
+/* a multiply or shift feeding an add, as mac and gep do in one */
+#define FUSED_ADD(name, first)                                               \
+    HANDLER(name) {                                                          \
+        Word value = first;                                                  \
+        RD = value;                                                          \
+        p->R[d[1].rd] = ((sWord)FUSED_OPERAND(d[1].rs1, value)) +            \
+                        ((sWord)FUSED_OPERAND(d[1].rs2, value));             \
+        p->PC += 8;                                                          \
+    }                                                                        \
+    HANDLER(name##_into) {                                                   \
+        Word value = first;                                                  \
+        RD = ((sWord)FUSED_OPERAND(d[1].rs1, value)) +                       \
+             ((sWord)FUSED_OPERAND(d[1].rs2, value));                        \
+        p->PC += 8;                                                          \
+    }
+
+FUSED_ADD(fused_mul_add, ((sWord)RS1) * ((sWord)RS2))
+FUSED_ADD(fused_slli_add, ((sWord)RS1) << d->imm)
+
+/* by op (isa.h); ops without one, and encodings the guards in decode()
+   turn away, run on the reference path */
+static const DecodedHandler handlers[ISA_COUNT] = {
+    [ISA_ADD] = op_add,     [ISA_MUL] = op_mul,   [ISA_SUB] = op_sub,
+    [ISA_SLL] = op_sll,     [ISA_MULH] = op_mulh, [ISA_SLT] = op_slt,
+    [ISA_XOR] = op_xor,     [ISA_DIV] = op_div,   [ISA_SRL] = op_srl,
+    [ISA_SRA] = op_sra,     [ISA_OR] = op_or,     [ISA_REM] = op_rem,
+    [ISA_AND] = op_and,
+    [ISA_ADDI] = op_addi,   [ISA_SLLI] = op_slli, [ISA_SLTI] = op_slti,
+    [ISA_XORI] = op_xori,   [ISA_SRLI] = op_srli, [ISA_SRAI] = op_srai,
+    [ISA_ORI] = op_ori,     [ISA_ANDI] = op_andi,
+    [ISA_LB] = op_lb,       [ISA_LH] = op_lh,     [ISA_LW] = op_lw,
+    [ISA_SB] = op_sb,       [ISA_SH] = op_sh,     [ISA_SW] = op_sw,
+    [ISA_BEQ] = op_beq,     [ISA_BNE] = op_bne,
+    [ISA_LUI] = op_lui,     [ISA_JAL] = op_jal,
+    [ISA_CSRRW ... ISA_CSRRCI] = op_csr,
+    [ISA_MAC] = op_mac,     [ISA_ACC] = op_acc,   [ISA_GEP] = op_gep,
+    [ISA_ADD8] = op_add8,   [ISA_ADD16] = op_add16,
+    [ISA_SUB8] = op_sub8,   [ISA_SUB16] = op_sub16,
+    [ISA_KADD8] = op_kadd8, [ISA_KADD16] = op_kadd16,
+    [ISA_MAC8] = op_mac8,   [ISA_MAC16] = op_mac16,
+    [ISA_DOT8] = op_dot8,   [ISA_DOT16] = op_dot16,
+    [ISA_MIN8] = op_min8,   [ISA_MIN16] = op_min16,
+    [ISA_MAX8] = op_max8,   [ISA_MAX16] = op_max16,
+    [ISA_VECTOR] = op_vector,
+};
+
+void decode(Word instruction_bits, DecodedInstruction *d) {
+    Word w = instruction_bits;
+    IsaOp op = isa_decode(w);
+
+    d->execute = handlers[op];
+    d->fused = NULL;
+    d->bits = w;
+    d->imm = 0;
+    d->rd = (w >> 7) & 0x1F;
+    d->rs1 = (w >> 15) & 0x1F;
+    d->rs2 = (w >> 20) & 0x1F;
+    d->flags = 0;
+    d->next = 0;
+
+    switch (isa_opcode_class[w & 0x7F]) {
+        case ISA_CLASS_I:
+        case ISA_CLASS_LOAD:
+            d->imm = isa_imm_i(w);
+            break;
+        case ISA_CLASS_STORE:
+            d->imm = isa_imm_s(w);
+            d->flags = DECODED_STORE;
+            break;
+        case ISA_CLASS_BRANCH:
+            d->imm = isa_imm_b(w);
+            d->flags = DECODED_BRANCH;
+            break;
+        case ISA_CLASS_JAL:
+            d->imm = isa_imm_j(w);
+            d->flags = DECODED_JUMP;
+            break;
+        case ISA_CLASS_LUI:
+            d->imm = isa_imm_u(w);
+            break;
+        case ISA_CLASS_ECALL:
+            d->imm = w >> 20;
+            d->flags = DECODED_CSR;
+            break;
+        case ISA_CLASS_VECTOR:
+            d->flags = (w & 0x7F) == 0x27 ? DECODED_STORE : 0;
+            break;
+    }
+
+    /* where a handler takes less than the table entry covers, or takes its
+       immediate the way the matching emulator.c case does */
+    switch (op) {
+        case ISA_XORI:
+            d->imm = w >> 20; // XORI does not sign-extend
+            break;
+        case ISA_SLLI:
+            d->imm &= 0x1F;
+            break;
+        case ISA_SRLI:
+        case ISA_SRAI:
+            d->imm &= 0x1F;
+            if ((w >> 25) != (op == ISA_SRLI ? 0x00 : 0x20)) {
+                d->execute = NULL;
+            }
+            break;
+        case ISA_CSRRW ... ISA_CSRRCI:
+            // writes and unknown CSRs stay on the reference path
+            if (csr_writes(w) || csr_name(w >> 20) == NULL) {
+                d->execute = NULL;
+            }
+            break;
+        case ISA_MAC:
+        case ISA_ACC:
+            // these also read rd, which must see x0, not the sink
+            if (d->rd == 0) {
+                d->execute = NULL;
+            }
+            break;
+        case ISA_ADD8 ... ISA_MAX16:
+            if (d->rd == 0 && PSIMD_READS_RD(w >> 25)) {
+                d->execute = NULL;
+            }
+            break;
+        case ISA_VECTOR:
+            // vl and vtype are only known as it runs; see op_vector
+            if (!vector_valid(w)) {
+                d->execute = NULL;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (d->execute == NULL) {
+        d->execute = op_fallback;
+        d->flags = DECODED_FALLBACK;
+    }
+    if (d->rd == 0) {
+        d->rd = REG_SINK;
+    }
+}
+
+/* Does second read the register first writes? */
+static int consumes(const DecodedInstruction *first,
+                    const DecodedInstruction *second) {
+    return second->rs1 == first->rd || second->rs2 == first->rd;
+}
+
+static DecodedHandler fusion(const DecodedInstruction *first,
+                             const DecodedInstruction *second) {
+    /* a first instruction writing x0 has rd == REG_SINK, which no source
+       field names, so it never looks like a producer */
+    if (first->execute == op_lui && second->execute == op_addi &&
+        second->rd == first->rd && second->rs1 == first->rd) {
+        return fused_lui_addi;
+    }
+    if (first->execute == op_addi && consumes(first, second)) {
+        if (second->execute == op_bne) {
+            return fused_addi_bne;
+        }
+        if (second->execute == op_beq) {
+            return fused_addi_beq;
+        }
+    }
+    if (second->execute == op_add && consumes(first, second)) {
+        // the first result is dead if the add overwrites it
+        int into = second->rd == first->rd;
+        if (first->execute == op_mul) {
+            return into ? fused_mul_add_into : fused_mul_add;
+        }
+        if (first->execute == op_slli) {
+            return into ? fused_slli_add_into : fused_slli_add;
+        }
+    }
+    return NULL;
+}
+
+void fuse_pairs(DecodedInstruction *code, int length) {
+    int i;
+    for (i = 0; i + 1 < length; i++) {
+        code[i].fused = fusion(&code[i], &code[i + 1]);
+        if (code[i].fused) {
+            i++; // pairs never overlap
+        }
+    }
+}
+
+static int access_size(DecodedHandler h) {
+    if (h == op_lb || h == op_sb) {
+        return 1;
+    }
+    if (h == op_lh || h == op_sh) {
+        return 2;
+    }
+    return h == op_lw || h == op_sw ? 4 : 0;
+}
+
+/* The step of an induction register, 0 if the loop never writes it */
+static sWord induction_step(const BulkIdiom *b, Byte reg) {
+    int i;
+    for (i = 0; i < b->inductions; i++) {
+        if (b->reg[i] == reg) {
+            return b->step[i];
+        }
+    }
+    return 0;
+}
+
+/* How far past its value at the top of the iteration reg has moved by the
+   time code[at] runs */
+static sWord stepped_by(const DecodedInstruction *code, int at, Byte reg) {
+    int i;
+    for (i = 0; i < at; i++) {
+        if (code[i].execute == op_addi && code[i].rd == reg) {
+            return code[i].imm;
+        }
+    }
+    return 0;
+}
+
+int detect_bulk_idiom(const DecodedInstruction *code, int length,
+                      Address entry, BulkIdiom *out) {
+    const DecodedInstruction *branch = &code[length - 1];
+    int i, j, load_at = -1, store_at = -1;
+
+    memset(out, 0, sizeof(*out));
+    if (length < 3 || branch->execute != op_bne || branch->next != entry) {
+        return 0;
+    }
+    for (i = 0; i < length - 1; i++) {
+        const DecodedInstruction *d = &code[i];
+
+        if (d->execute == op_addi) {
+            // a sink rd never equals rs1, so x0 is no induction register
+            if (d->rd != d->rs1 || d->imm == 0 ||
+                out->inductions == BULK_MAX_INDUCTION) {
+                return 0;
+            }
+            for (j = 0; j < out->inductions; j++) {
+                if (out->reg[j] == d->rd) {
+                    return 0;
+                }
+            }
+            out->reg[out->inductions] = d->rd;
+            out->step[out->inductions++] = d->imm;
+        } else if (access_size(d->execute) && (d->flags & DECODED_STORE)) {
+            if (store_at >= 0) {
+                return 0;
+            }
+            store_at = i;
+        } else if (access_size(d->execute)) {
+            if (load_at >= 0) {
+                return 0;
+            }
+            load_at = i;
+        } else {
+            return 0;
+        }
+    }
+    if (store_at < 0) {
+        return 0;
+    }
+
+    out->size = access_size(code[store_at].execute);
+    out->dst = code[store_at].rs1;
+    out->dst_offset = code[store_at].imm + stepped_by(code, store_at, out->dst);
+    if (induction_step(out, out->dst) != out->size) {
+        return 0;
+    }
+    if (load_at >= 0) {
+        const DecodedInstruction *load = &code[load_at];
+        /* the loaded value goes straight to the store and nowhere else */
+        if (load_at > store_at || access_size(load->execute) != out->size ||
+            code[store_at].rs2 != load->rd || induction_step(out, load->rd) ||
+            load->rd == load->rs1 || load->rd == out->dst ||
+            load->rd == branch->rs1 || load->rd == branch->rs2) {
+            return 0;
+        }
+        out->src = load->rs1;
+        out->src_offset = load->imm + stepped_by(code, load_at, out->src);
+        if (induction_step(out, out->src) != out->size) {
+            return 0;
+        }
+    } else {
+        out->src = code[store_at].rs2;
+        if (induction_step(out, out->src)) {
+            return 0;
+        }
+    }
+
+    if (induction_step(out, branch->rs1) && !induction_step(out, branch->rs2)) {
+        out->counter = branch->rs1;
+        out->bound = branch->rs2;
+    } else if (induction_step(out, branch->rs2) && !induction_step(out, branch->rs1)) {
+        out->counter = branch->rs2;
+        out->bound = branch->rs1;
+    } else {
+        return 0;
+    }
+    out->counter_step = induction_step(out, out->counter);
+    out->kind = load_at >= 0 ? BULK_COPY : BULK_FILL;
+    return 1;
+}
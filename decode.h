@@ -0,0 +1,83 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "types.h"
+
+/* Pre-decoded form of one instruction. Fields are extracted and immediates
+   sign-extended once, so executing it is a single indirect call with no
+   parsing or opcode dispatch. Encodings without a specialised handler
+   (ecall, invalid or unknown instructions) decode to a fallback that runs
+   the reference execute_instruction() on the raw bits. Plain byte fields
+   replace the Instruction union's bitfields, and a destination of x0 is
+   redirected to REG_SINK here rather than undone after every instruction. */
+
+typedef struct DecodedInstruction DecodedInstruction;
+
+typedef void (*DecodedHandler)(const DecodedInstruction *, Processor *,
+                               Byte *memory);
+
+/* flags */
+#define DECODED_BRANCH 0x1   /* conditional branch */
+#define DECODED_JUMP 0x2     /* jal */
+#define DECODED_FALLBACK 0x4 /* runs through execute_instruction() */
+#define DECODED_STORE 0x8
+#define DECODED_CSR 0x10     /* CSR read */
+
+struct DecodedInstruction {
+    DecodedHandler execute;
+    /* if set, runs this instruction and the one after it in the block as a
+       single operation; see fuse_pairs() */
+    DecodedHandler fused;
+    Word bits;
+    sWord imm; /* sign-extended immediate, or branch/jump offset */
+    Byte rd;   /* REG_SINK when the encoding names x0 */
+    Byte rs1;
+    Byte rs2;
+    Byte flags;
+    /* for branches inside a superblock: the PC the trace continues at; for
+       anything else: the instructions ahead of it in the superblock */
+    Address next;
+};
+
+void decode(Word instruction_bits, DecodedInstruction *out);
+
+/* Peephole pass over a straight-line run of decoded instructions (a
+   superblock). Marks common idioms so each pair executes as one host
+   operation: lui+addi constants, addi+bne/beq loop counters, mul+add
+   (what the custom mac op does) and slli+add address arithmetic (gep).
+   Register results match executing the two instructions one by one. */
+void fuse_pairs(DecodedInstruction *code, int length);
+
+/* A loop whose every iteration stores one element and steps its pointers
+   by the element size: a fill (sb/sh/sw of an unchanging register) or a
+   copy (a load, then a store of what it loaded). The rest of the body is
+   addi rd, rd, imm induction updates, and a bne of one induction register
+   against an unchanging one closes it. Offsets are from the base register's
+   value at the top of an iteration to the element it touches there. */
+#define BULK_NONE 0
+#define BULK_FILL 1
+#define BULK_COPY 2
+#define BULK_MAX_INDUCTION 4
+
+typedef struct {
+    Byte kind;
+    Byte size;    /* element size and pointer step */
+    Byte dst;     /* store base register */
+    Byte src;     /* load base register, or the stored value for a fill */
+    sWord dst_offset;
+    sWord src_offset;
+    Byte counter; /* the bne operands: the one that steps... */
+    Byte bound;   /* ...and the one that does not */
+    sWord counter_step;
+    int inductions;
+    Byte reg[BULK_MAX_INDUCTION];
+    sWord step[BULK_MAX_INDUCTION];
+} BulkIdiom;
+
+/* Fills in out for a superblock that is exactly one iteration of such a
+   loop (its last instruction branches back to entry) and returns 1;
+   otherwise sets out->kind to BULK_NONE and returns 0 */
+int detect_bulk_idiom(const DecodedInstruction *code, int length,
+                      Address entry, BulkIdiom *out);
+
+#endif
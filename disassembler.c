@@ -1,247 +1,23 @@
 #include <stdio.h> // for stderr
 #include <stdlib.h> // for exit()
+#include <pthread.h>
 #include "types.h"
 #include "utils.h"
+#include "riscv.h"
+#include "isa.h"
+#include "vector.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-void print_rtype(char *, Instruction);
-void print_itype_except_load(char *, Instruction, int);
-void print_load(char *, Instruction);
-void print_store(char *, Instruction);
-void print_branch(char *, Instruction);
-void print_custom(char *, Instruction);
-void print_lui(Instruction);
-void print_jal(Instruction);
-void print_ecall(Instruction);
-void write_rtype(Instruction);
-void write_itype_except_load(Instruction); 
-void write_load(Instruction);
-void write_store(Instruction);
-void write_branch(Instruction);
-void write_custom(Instruction);
-
-
+/* One instruction, as the bulk path lists it without the address; an
+   unknown opcode prints nothing, and execution then stops on it */
 void decode_instruction(uint32_t instruction_bits) {
-    Instruction instruction = parse_instruction(instruction_bits);
-    switch(instruction.opcode) {
-        case 0x33:
-            write_rtype(instruction);
-            break;
-        case 0x13:
-            write_itype_except_load(instruction);
-            break;
-        case 0x3:
-            write_load(instruction);
-            break;
-        case 0x23:
-            write_store(instruction);
-            break;
-        case 0x63:
-            write_branch(instruction);
-            break;
-        case 0x37:
-            print_lui(instruction);
-            break;
-        case 0x6F:
-            print_jal(instruction);
-            break;
-        case 0x73:
-            print_ecall(instruction);
-            break;
-        case 0x2b:
-            write_custom(instruction);
-            break;
-        default: // undefined opcode
-            handle_invalid_instruction(instruction);
-            break;
-    }
-}
-
-void write_rtype(Instruction instruction) {
-    switch (instruction.rtype.funct3) {
-        case 0x0:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                    print_rtype("add", instruction);
-                    break;
-                case 0x1:
-                    print_rtype("mul", instruction);
-                    break;
-                case 0x20:
-                    print_rtype("sub", instruction);
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                break;      
-            }
-            break;
-        case 0x1:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                print_rtype("sll", instruction);
-                break;
-                case 0x1:
-                print_rtype("mulh", instruction);
-                break;
-                default:
-                handle_invalid_instruction(instruction);
-                break;
-            }
-            break;
-        case 0x2:
-            print_rtype("slt", instruction);
-            break;
-        case 0x4:
-            switch (instruction.rtype.funct7) {
-                case 0x0:   
-                print_rtype("xor", instruction);
-                break;
-                case 0x1:
-                print_rtype("div", instruction);
-                break;
-                default:
-                handle_invalid_instruction(instruction);
-                break;
-            }
-            break;
-        case 0x5:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                print_rtype("srl", instruction);
-                break;
-                case 0x20:
-                print_rtype("sra", instruction);
-                break;
-                default:
-                handle_invalid_instruction(instruction);
-                break;
-            }
-            break;
-        case 0x6:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                print_rtype("or", instruction);
-                break;
-                case 0x1:
-                print_rtype("rem", instruction);
-                break;
-                default:
-                handle_invalid_instruction(instruction);
-                break;
-            }
-            break;
-        case 0x7:
-            print_rtype("and", instruction);
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-        break;
-    }
-}
+    char line[DISASM_MAX_LINE];
+    int stopped;
+    size_t length = disassemble_block(&instruction_bits, 1, 0, line, &stopped);
 
-void write_itype_except_load(Instruction instruction) {
-    int shiftOp;
-    switch (instruction.itype.funct3) {
-        case 0x0:
-            print_itype_except_load("addi", instruction, instruction.itype.imm);
-            break;
-        case 0x1:
-            print_itype_except_load("slli", instruction, instruction.itype.imm);
-            break;
-        case 0x2:
-            print_itype_except_load("slti", instruction, instruction.itype.imm);
-            break;
-        case 0x4:
-            print_itype_except_load("xori", instruction, instruction.itype.imm);
-            break;
-        case 0x5:
-            shiftOp = instruction.itype.imm >> 10;
-            switch(shiftOp) {
-                case 0x0:
-                    print_itype_except_load("srli", instruction, instruction.itype.imm & 0x1F);
-                    break;
-                case 0x1:
-                    print_itype_except_load("srai", instruction, instruction.itype.imm & 0x1F);
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                    break;
-            }
-            break;
-        case 0x6:
-            print_itype_except_load("ori", instruction, instruction.itype.imm);
-            break;
-        case 0x7:
-            print_itype_except_load("andi", instruction, instruction.itype.imm);
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;  
-    }
-}
-
-void write_load(Instruction instruction) {
-    switch (instruction.itype.funct3) {
-        case 0x0:
-            print_load("lb", instruction);
-            break;
-        case 0x1:
-            print_load("lh", instruction);
-            break;
-        case 0x2:
-            print_load("lw", instruction);
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
-    }
-}
-
-void write_store(Instruction instruction) {
-    switch (instruction.stype.funct3) {
-        case 0x0:
-            print_store("sb", instruction);
-            break;
-        case 0x1:
-            print_store("sh", instruction);
-            break;
-        case 0x2:
-            print_store("sw", instruction);
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
-    }
-}
-
-void write_branch(Instruction instruction) {
-    switch (instruction.sbtype.funct3) {
-        case 0x0:
-            print_branch("beq", instruction);
-            break;
-        case 0x1:
-            print_branch("bne", instruction);
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
-    }
-}
-
-void write_custom(Instruction instruction) {
-    switch (instruction.rtype.funct3) {
-        case 0x0:
-            print_custom("mac", instruction);
-            break;
-        case 0x1:
-            print_custom("acc", instruction);
-            break;
-        case 0x2:
-            print_custom("gep", instruction);
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
-    }
+    fwrite(line + 10, 1, length - 10, stdout);
 }
 
 // bash ./scripts/localci.sh
@@ -265,43 +41,410 @@ void write_custom(Instruction instruction) {
 // diff ./code/out/UJ/UJ.solution ./code/ref/UJ/UJ.solution
 // You can replace R with any of the other instruction types R, I, S, SB, U, J
 
-void print_lui(Instruction instruction) {
-    printf(LUI_FORMAT, instruction.utype.rd, instruction.utype.imm);
+const char *csr_name(Word csr) {
+    switch (csr) {
+        case CSR_CYCLE: return "cycle";
+        case CSR_TIME: return "time";
+        case CSR_INSTRET: return "instret";
+        case CSR_CYCLEH: return "cycleh";
+        case CSR_TIMEH: return "timeh";
+        case CSR_INSTRETH: return "instreth";
+        case CSR_VL: return "vl";
+        case CSR_VTYPE: return "vtype";
+        case CSR_VLENB: return "vlenb";
+        case CSR_MSTATUS: return "mstatus";
+        case CSR_MIE: return "mie";
+        case CSR_MTVEC: return "mtvec";
+        case CSR_MSCRATCH: return "mscratch";
+        case CSR_MEPC: return "mepc";
+        case CSR_MCAUSE: return "mcause";
+        case CSR_MTVAL: return "mtval";
+        case CSR_MIP: return "mip";
+    }
+    return NULL;
 }
 
-void print_jal(Instruction instruction) {
-    int offset = get_jump_offset(instruction);
-    printf(JAL_FORMAT, instruction.ujtype.rd, offset);
+/* Bulk disassembly (-d). Classifies whole batches of words at once, looks
+   mnemonics up in the decode table (isa.h) and formats operands by hand
+   into one large buffer. */
+
+/* Per-word fields packed as opcode | funct3 << 8 | funct7 bucket << 11 */
+static void classify_batch(const Word *words, size_t count, uint16_t *keys) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i mask7 = _mm_set1_epi32(0x7F);
+    const __m128i mask3 = _mm_set1_epi32(0x7);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128i three = _mm_set1_epi32(3);
+    const __m128i f7_sub = _mm_set1_epi32(0x20);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i w = _mm_loadu_si128((const __m128i *)(words + i));
+        __m128i opcode = _mm_and_si128(w, mask7);
+        __m128i funct3 = _mm_and_si128(_mm_srli_epi32(w, 12), mask3);
+        __m128i funct7 = _mm_srli_epi32(w, 25);
+        __m128i is0 = _mm_cmpeq_epi32(funct7, _mm_setzero_si128());
+        __m128i is1 = _mm_cmpeq_epi32(funct7, one);
+        __m128i is20 = _mm_cmpeq_epi32(funct7, f7_sub);
+        __m128i other = _mm_andnot_si128(_mm_or_si128(is0, _mm_or_si128(is1, is20)), three);
+        __m128i bucket = _mm_or_si128(other, _mm_or_si128(_mm_and_si128(is1, one),
+                                                          _mm_and_si128(is20, two)));
+        __m128i key = _mm_or_si128(
+            _mm_or_si128(opcode, _mm_slli_epi32(funct3, 8)),
+            _mm_slli_epi32(bucket, 11));
+        // keys fit in 13 bits, so a signed pack keeps them intact
+        key = _mm_packs_epi32(key, key);
+        _mm_storel_epi64((__m128i *)(keys + i), key);
+    }
+#endif
+    for (; i < count; i++) {
+        Word w = words[i];
+        keys[i] = (w & 0x7F) | ((w >> 12) & 0x7) << 8 |
+                  isa_funct7_bucket(w >> 25) << 11;
+    }
 }
 
-void print_ecall(Instruction instruction) {
-    printf(ECALL_FORMAT);
+static inline char *put_string(char *out, const char *s) {
+    while (*s) {
+        *out++ = *s++;
+    }
+    return out;
 }
 
-void print_rtype(char *name, Instruction instruction) {
-    printf(RTYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2);
+static inline char *put_int(char *out, int value) {
+    char digits[10];
+    unsigned int v = value < 0 ? 0U - (unsigned int)value : (unsigned int)value;
+    int n = 0;
+
+    if (value < 0) {
+        *out++ = '-';
+    }
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) {
+        *out++ = digits[--n];
+    }
+    return out;
 }
 
-void print_itype_except_load(char *name, Instruction instruction, int imm) {
-    printf(ITYPE_FORMAT, name, instruction.itype.rd, instruction.itype.rs1, sign_extend_number((unsigned int)imm, 12U));
-        // printf(ITYPE_FORMAT, name, instruction.itype.rd, instruction.itype.rs1, imm);
+static inline char *put_reg(char *out, unsigned int reg) {
+    *out++ = 'x';
+    if (reg >= 10) {
+        *out++ = '0' + reg / 10;
+    }
+    *out++ = '0' + reg % 10;
+    return out;
 }
 
-void print_load(char *name, Instruction instruction) {
-    printf(MEM_FORMAT, name, instruction.itype.rd, sign_extend_number((unsigned int)instruction.itype.imm, 12U), instruction.itype.rs1);
-    // printf(MEM_FORMAT, name, instruction.itype.rd, instruction.itype.imm, instruction.itype.rs1);
+static inline char *put_hex(char *out, Word value, int digits) {
+    static const char hex[] = "0123456789abcdef";
+    int i;
+    for (i = digits - 1; i >= 0; i--) {
+        out[i] = hex[value & 0xF];
+        value >>= 4;
+    }
+    return out + digits;
 }
 
-void print_store(char *name, Instruction instruction) {
-    int offset = get_store_offset(instruction);
-    printf(MEM_FORMAT, name, instruction.stype.rs2, offset, instruction.stype.rs1);
+static inline char *put_hex8(char *out, Word value) {
+    return put_hex(out, value, 8);
 }
 
-void print_branch(char *name, Instruction instruction) {
-    int offset = get_branch_offset(instruction);
-    printf(BRANCH_FORMAT, name, instruction.sbtype.rs1, instruction.sbtype.rs2, offset);
+#define SEP(out) (*(out)++ = ',', *(out)++ = ' ')
+
+size_t disassemble_block(const Word *words, size_t count, Address base,
+                         char *out, int *stopped) {
+    uint16_t keys[DISASM_BATCH];
+    char *start = out;
+    size_t i, j, n;
+
+    *stopped = 0;
+    for (i = 0; i < count; i += n) {
+        n = count - i < DISASM_BATCH ? count - i : DISASM_BATCH;
+        classify_batch(words + i, n, keys);
+
+        for (j = 0; j < n; j++) {
+            Word w = words[i + j];
+            Word key = keys[j];
+            Word cls = isa_opcode_class[key & 0x7F];
+            Word funct3 = (key >> 8) & 0x7;
+            const IsaInfo *e =
+                &isa_info[isa_lookup(cls, funct3, key >> 11, w)];
+
+            out = put_hex8(out, base + (i + j) * 4);
+            *out++ = ':';
+            *out++ = ' ';
+
+            if (cls == ISA_CLASS_UNKNOWN) {
+                // execution stops here too, after the address is out
+                *stopped = 1;
+                return out - start;
+            }
+
+            if (e->format != ISA_FMT_INVALID && e->format != ISA_FMT_ECALL &&
+                e->format != ISA_FMT_VECTOR) {
+                out = put_string(out, e->mnemonic);
+                *out++ = '\t';
+            }
+            switch (e->format) {
+                case ISA_FMT_INVALID:
+                    out = put_string(out, "Invalid Instruction: 0x");
+                    out = put_hex8(out, w);
+                    break;
+                case ISA_FMT_R:
+                    out = put_reg(out, (w >> 7) & 0x1F);
+                    SEP(out);
+                    out = put_reg(out, (w >> 15) & 0x1F);
+                    SEP(out);
+                    out = put_reg(out, (w >> 20) & 0x1F);
+                    break;
+                case ISA_FMT_I:
+                    out = put_reg(out, (w >> 7) & 0x1F);
+                    SEP(out);
+                    out = put_reg(out, (w >> 15) & 0x1F);
+                    SEP(out);
+                    // srli and srai show the shift amount alone
+                    out = put_int(out, funct3 == 0x5 ? (sWord)(w >> 20) & 0x1F
+                                                     : isa_imm_i(w));
+                    break;
+                case ISA_FMT_LOAD:
+                    out = put_reg(out, (w >> 7) & 0x1F);
+                    SEP(out);
+                    out = put_int(out, isa_imm_i(w));
+                    *out++ = '(';
+                    out = put_reg(out, (w >> 15) & 0x1F);
+                    *out++ = ')';
+                    break;
+                case ISA_FMT_STORE:
+                    out = put_reg(out, (w >> 20) & 0x1F);
+                    SEP(out);
+                    out = put_int(out, isa_imm_s(w));
+                    *out++ = '(';
+                    out = put_reg(out, (w >> 15) & 0x1F);
+                    *out++ = ')';
+                    break;
+                case ISA_FMT_BRANCH:
+                    out = put_reg(out, (w >> 15) & 0x1F);
+                    SEP(out);
+                    out = put_reg(out, (w >> 20) & 0x1F);
+                    SEP(out);
+                    out = put_int(out, isa_imm_b(w));
+                    break;
+                case ISA_FMT_LUI:
+                    out = put_reg(out, (w >> 7) & 0x1F);
+                    SEP(out);
+                    out = put_int(out, w >> 12);
+                    break;
+                case ISA_FMT_JAL:
+                    out = put_reg(out, (w >> 7) & 0x1F);
+                    SEP(out);
+                    out = put_int(out, isa_imm_j(w));
+                    break;
+                case ISA_FMT_ECALL:
+                    out = put_string(out, w == INSTRUCTION_MRET ? "mret"
+                                          : w == INSTRUCTION_WFI ? "wfi"
+                                          : "ecall");
+                    break;
+                case ISA_FMT_CSR:
+                case ISA_FMT_CSRI: {
+                    const char *csr = csr_name(w >> 20);
+                    out = put_reg(out, (w >> 7) & 0x1F);
+                    SEP(out);
+                    if (csr) {
+                        out = put_string(out, csr);
+                    } else {
+                        out = put_string(out, "0x");
+                        out = put_hex(out, w >> 20, 3);
+                    }
+                    SEP(out);
+                    if (e->format == ISA_FMT_CSR) {
+                        out = put_reg(out, (w >> 15) & 0x1F);
+                    } else {
+                        out = put_int(out, (w >> 15) & 0x1F);
+                    }
+                    break;
+                }
+                case ISA_FMT_VECTOR: {
+                    int length = vector_format(w, out, DISASM_MAX_LINE);
+                    if (length) {
+                        out += length;
+                    } else {
+                        out = put_string(out, "Invalid Instruction: 0x");
+                        out = put_hex8(out, w);
+                    }
+                    break;
+                }
+            }
+            *out++ = '\n';
+        }
+    }
+    return out - start;
+}
+
+/* a batch at a time through a buffer on the stack, so that concurrent
+   callers share nothing; stdio does the large writes */
+static int disassemble_serial(const Word *words, size_t count, Address base,
+                              FILE *file) {
+    char buffer[DISASM_BATCH * DISASM_MAX_LINE];
+    size_t i, n;
+    int stopped = 0;
+
+    for (i = 0; i < count && !stopped; i += n) {
+        n = count - i < DISASM_BATCH ? count - i : DISASM_BATCH;
+        fwrite(buffer, 1,
+               disassemble_block(words + i, n, base + i * 4, buffer, &stopped),
+               file);
+    }
+    return stopped ? -1 : 0;
+}
+
+/* Parallel listing: workers claim DISASM_CHUNK-word chunks in order and fill
+   one of a small ring of slot buffers; the calling thread writes finished
+   slots strictly in chunk order. Chunk c may only start once chunk
+   c - slots has been written, which bounds memory to slots buffers. */
+
+typedef struct {
+    char *buffer;
+    size_t length;
+    int stopped;
+    int ready;
+} DisasmSlot;
+
+typedef struct {
+    const Word *words;
+    size_t count;
+    Address base;
+    size_t chunks;
+    size_t next_chunk; /* next chunk a worker may claim */
+    size_t written;    /* chunks written out so far */
+    int stop;
+    int nslots;
+    DisasmSlot *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} DisasmJob;
+
+static void *disassemble_worker(void *arg) {
+    DisasmJob *job = arg;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        size_t c, first, n;
+        DisasmSlot *slot;
+        int stopped;
+
+        while (!job->stop && job->next_chunk < job->chunks &&
+               job->next_chunk >= job->written + job->nslots) {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        if (job->stop || job->next_chunk >= job->chunks) {
+            break;
+        }
+        c = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+
+        first = c * DISASM_CHUNK;
+        n = job->count - first < DISASM_CHUNK ? job->count - first : DISASM_CHUNK;
+        slot = &job->slots[c % job->nslots];
+        slot->length = disassemble_block(job->words + first, n,
+                                         job->base + first * 4, slot->buffer,
+                                         &stopped);
+
+        pthread_mutex_lock(&job->lock);
+        slot->stopped = stopped;
+        slot->ready = 1;
+        pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
 }
 
-void print_custom(char* name, Instruction instruction) {
-    printf(RTYPE_FORMAT, name, instruction.rtype.rd, instruction.rtype.rs1, instruction.rtype.rs2);
+int disassemble_program(const Word *words, size_t count, Address base,
+                        FILE *file, int threads) {
+    DisasmJob job;
+    pthread_t *workers;
+    size_t c;
+    int i, started = 0, stopped = 0;
+
+    job.chunks = (count + DISASM_CHUNK - 1) / DISASM_CHUNK;
+    if (threads > (int)job.chunks) {
+        threads = job.chunks;
+    }
+    if (threads <= 1) {
+        return disassemble_serial(words, count, base, file);
+    }
+
+    job.words = words;
+    job.count = count;
+    job.base = base;
+    job.next_chunk = 0;
+    job.written = 0;
+    job.stop = 0;
+    job.nslots = 2 * threads;
+    job.slots = calloc(job.nslots, sizeof(DisasmSlot));
+    workers = calloc(threads, sizeof(pthread_t));
+    if (job.slots == NULL || workers == NULL) {
+        free(job.slots);
+        free(workers);
+        return disassemble_serial(words, count, base, file);
+    }
+    for (i = 0; i < job.nslots; i++) {
+        job.slots[i].buffer = malloc(DISASM_CHUNK * DISASM_MAX_LINE);
+        if (job.slots[i].buffer == NULL) {
+            job.nslots = i;
+            break;
+        }
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+    if (job.nslots > 0) {
+        for (started = 0; started < threads; started++) {
+            if (pthread_create(&workers[started], NULL, disassemble_worker, &job) != 0) {
+                break;
+            }
+        }
+    }
+
+    if (started == 0) {
+        stopped = disassemble_serial(words, count, base, file) != 0;
+    } else {
+        for (c = 0; c < job.chunks && !stopped; c++) {
+            DisasmSlot *slot = &job.slots[c % job.nslots];
+
+            pthread_mutex_lock(&job.lock);
+            while (!slot->ready) {
+                pthread_cond_wait(&job.changed, &job.lock);
+            }
+            pthread_mutex_unlock(&job.lock);
+
+            fwrite(slot->buffer, 1, slot->length, file);
+            stopped = slot->stopped;
+
+            pthread_mutex_lock(&job.lock);
+            slot->ready = 0;
+            job.written++;
+            job.stop = stopped;
+            pthread_cond_broadcast(&job.changed);
+            pthread_mutex_unlock(&job.lock);
+        }
+        pthread_mutex_lock(&job.lock);
+        job.stop = 1;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+        for (i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    for (i = 0; i < job.nslots; i++) {
+        free(job.slots[i].buffer);
+    }
+    free(job.slots);
+    free(workers);
+    return stopped ? -1 : 0;
 }
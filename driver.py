@@ -8,6 +8,9 @@ import sys
 import argparse
 import shutil
 import json
+import hashlib
+import time
+import concurrent.futures
 
 running = {
 }
@@ -144,7 +147,176 @@ tests_json = """{
 }
 """
 
+
+def case(flags, input, output, ref=None, points=15):
+    """The usual check: run ./riscv with flags on code/input/input into
+    code/out/output, then diff that against code/ref/ref (by default the
+    same name). Listings (-d) finish at once; anything that runs the program
+    gets a timeout."""
+    out = "./code/out/" + output
+    run = "./riscv %s ./code/input/%s > %s" % (flags, input, out)
+    if flags != "-d":
+        run = "timeout 60 " + run
+    return {run: 0, "diff %s ./code/ref/%s" % (out, ref or output): points}
+
+
+def packed_case(flags, name, points=15):
+    """Records code/input/name/name.input as a packed trace (-R), unpacks
+    its first 100 instructions (-x) and diffs those against
+    code/ref/name/name.trace"""
+    out = "./code/out/%s/%s" % (name, name)
+    record = "./riscv %s-R %s.rvrt ./code/input/%s/%s.input" % (
+        flags + " " if flags else "", out, name, name)
+    unpack = "./riscv -x 0:100 %s.rvrt > %s.unpacked" % (out, out)
+    return {record: 0, unpack: 0,
+            "diff %s.unpacked ./code/ref/%s/%s.trace" % (out, name, name): points}
+
+
+def group(part1, part2):
+    """A test group from the cases of each part, run in order"""
+    return {part: {command: points for c in cases for command, points in c.items()}
+            for part, cases in (("Part1", part1), ("Part2", part2))}
+
+
+REPLAY = "-J ./code/ref/time.replay"
+DISK = "./code/input/block.disk"
+
+# Groups of the extensions, added to tests_json ahead of "All"
+extension_tests = {
+    "packed": group([packed_case("", "R")], [packed_case("-v", "Ri")]),
+    "psimd": group([case("-d", "custom_psimd.input", "custom_psimd.solution")],
+                   [case("-r", "custom_psimd.input", "custom_psimd.trace")]),
+    "vector": group([case("-d", "vector.input", "vector.solution")],
+                    [case("-r -e", "vector.input", "vector.trace")]),
+    "bulk": group([case("-d", "bulk.input", "bulk.solution")],
+                  [case("-e", "bulk.input", "bulk.output"),
+                   case("-n -e", "bulk.input", "bulk_n.output", "bulk.output")]),
+    "trigger": group([case("-r -e -T 10:13", "multiply.input",
+                           "multiply_window.trace"),
+                      case("-r -e -T 0:13 -T 10:", "multiply.input",
+                           "multiply_windows.trace", "multiply_window.trace")],
+                     [case("-r -e -T write=0xefffd -T pc=0x1020:0x1040",
+                           "multiply.input", "multiply_watch.trace")]),
+    "replay": group([case("-e " + REPLAY, "time.input", "time.output")],
+                    [case("-r -e -n %s -T pc=0x1014:0x105C" % REPLAY,
+                          "time.input", "time_window.trace")]),
+    "trap": group([case("-e", "trap.input", "trap.output"),
+                   case("-e", "divide.input", "divide.output")],
+                  [case("-r -e -n", "trap.input", "trap.trace"),
+                   case("-e -n", "divide.input", "divide_n.output",
+                        "divide.output")]),
+    "mmio": group([case("-e", "mmio.input", "mmio.output"),
+                   case("-e", "clint.input", "clint.output")],
+                  [case("-r -e -n", "mmio.input", "mmio.trace"),
+                   case("-e -n", "clint.input", "clint_n.output",
+                        "clint.output")]),
+    "fusion": group([case("-e", "fusion.input", "fusion.output"),
+                     case("-e -n", "fusion.input", "fusion_n.output",
+                          "fusion.output")],
+                    [case("-r -e", "fusion.input", "fusion.trace"),
+                     case("-r -e -n", "fusion.input", "fusion_n.trace",
+                          "fusion.trace")]),
+    "block": group([case("-e -D " + DISK, "block.input", "block.output")],
+                   [case("-e -n -W " + DISK, "block.input", "block_cow.output"),
+                    case("-e -n -D " + DISK, "block_queue.input",
+                         "block_queue.output")]),
+}
+
+
+def load_tests():
+    """tests_json with the extension groups, "All" still last"""
+    tests = json.loads(tests_json)
+    everything = tests.pop("All")
+    tests.update(extension_tests)
+    tests["All"] = everything
+    return tests
+
 Final = {}
+
+# Passing results of unchanged tests are reused from here, see part_key()
+CACHE_FILE = ".driver_cache.json"
+
+
+def file_digest(path, digests={}):
+    """sha256 of a file's contents, memoized for the run"""
+    if path not in digests:
+        h = hashlib.sha256()
+        with open(path, "rb") as f:
+            for chunk in iter(lambda: f.read(1 << 20), b""):
+                h.update(chunk)
+        digests[path] = h.hexdigest()
+    return digests[path]
+
+
+def part_key(commands):
+    """Hash of a part's commands and of every file they read: the emulator
+    binary, inputs, reference outputs and checker scripts, including the
+    reference trace part2_tester.py finds by test name. Files under
+    code/out are produced by the commands themselves and are left out."""
+    h = hashlib.sha256()
+    for command in commands:
+        h.update(command.encode() + b"\0")
+        paths = [os.path.normpath(token) for token in command.split()]
+        # part2_tester.py <name> reads code/ref/<name>.trace, named by neither
+        if "part2_tester.py" in paths:
+            paths += [os.path.join("code", "ref", name + ".trace")
+                      for name in paths[paths.index("part2_tester.py") + 1:]]
+        for path in paths:
+            if os.path.isfile(path) and not path.startswith("code/out"):
+                h.update(path.encode() + file_digest(path).encode())
+    return h.hexdigest()
+
+
+def run_part(group, part, commands, cache):
+    """Runs one part's commands in order (later ones check the output of
+    earlier ones) and returns a result per command"""
+    key = part_key(commands)
+    if key in cache:
+        return key, [dict(result, cached=True) for result in cache[key]]
+    results = []
+    for command in commands:
+        start = time.monotonic()
+        p = subprocess.Popen(command,
+                             shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        stdout_data, stderr_data = p.communicate()
+        results.append({"group": group, "part": part, "command": command,
+                        "returncode": p.returncode,
+                        "stdout": stdout_data.decode(errors="replace"),
+                        "seconds": round(time.monotonic() - start, 6),
+                        "cached": False})
+    return key, results
+
+
+def run_group(group, parts, cache):
+    """Runs a group's parts one after the other, since later parts may use
+    files earlier ones wrote; returns {part: (key, results)}"""
+    return {part: run_part(group, part, list(commands.keys()), cache)
+            for part, commands in parts.items()}
+
+
+def passed(results):
+    return all(result["returncode"] == 0 for result in results)
+
+
+def load_cache(enabled):
+    """Only passing parts are cached, so a failure always reruns"""
+    if not enabled:
+        return {}
+    try:
+        with open(CACHE_FILE) as f:
+            cache = json.load(f)
+    except (OSError, ValueError):
+        return {}
+    return {key: results for key, results in cache.items() if passed(results)}
+
+
+def save_cache(cache):
+    tmp = CACHE_FILE + ".tmp"
+    with open(tmp, "w") as f:
+        json.dump(cache, f)
+    os.replace(tmp, CACHE_FILE)
+
+
 #
 # main - Main function
 #
@@ -161,6 +333,11 @@ def main():
 
     parser.add_argument("-D", dest="output",
                         help="output directory", required=True)
+    parser.add_argument("-j", dest="jobs", type=int, default=os.cpu_count(),
+                        help="test groups to run concurrently (default: one per CPU)")
+    parser.add_argument("--no-cache", action="store_false", dest="cache",
+                        help="rerun every test instead of reusing results for "
+                        "an unchanged binary and inputs")
 
     opts = parser.parse_args()
     autograde = opts.autograde
@@ -168,31 +345,46 @@ def main():
     if os.path.exists(output_folder):
         shutil.rmtree(output_folder)
 
-    test_dict = json.loads(tests_json)
-
-    # Check the correctness and performance of the transpose function
-    # 32x32 transpose
+    test_dict = load_tests()
     for r in test_dict.keys():
         if not os.path.exists(output_folder+"/"+r):
             os.makedirs(output_folder + "/" + r)
+
+    # Groups write disjoint files, so they run concurrently, one future per
+    # group running its parts in order. Results are reported in
+    # load_tests() order.
+    cache = load_cache(opts.cache)
+    start = time.monotonic()
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max(1, opts.jobs)) as pool:
+        futures = {r: pool.submit(run_group, r, test_dict[r], cache)
+                   for r in test_dict.keys()}
+    wall_seconds = time.monotonic() - start
+
+    timing = []
+    for r in test_dict.keys():
         # Reset points
         for parts in ("Part1", "Part2"):
             total = 0
             points = 0
-            for tests in test_dict[r][parts].keys():
-                p = subprocess.Popen(tests,
-                                     shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-                stdout_data, stderr_data = p.communicate()
+            key, results = futures[r].result()[parts]
+            if passed(results):
+                cache[key] = [dict(result, cached=False) for result in results]
+            else:
+                cache.pop(key, None)
+            for result in results:
+                tests = result["command"]
+                timing.append({k: result[k] for k in
+                               ("group", "part", "command", "returncode", "seconds", "cached")})
                 total = total + test_dict[r][parts][tests]
-                if(p.returncode != 0):
+                if(result["returncode"] != 0):
                     Error += "### " + "*"*5+tests+"*"*5
-                    Error += "\n ```" + stdout_data.decode()
+                    Error += "\n ```" + result["stdout"]
                     Error += "\n```\n"
                     PassOrFail = 1
                 else:
                     points += test_dict[r][parts][tests]
                     Success += "### " + "*"*5+tests+"*"*5
-                    Success += "\n ```" + stdout_data.decode() + "\n```\n"
+                    Success += "\n ```" + result["stdout"] + "\n```\n"
 
             if points < total/2:
                 Final[(r + parts).lower()] = {"mark": points,
@@ -203,32 +395,13 @@ def main():
             else:
                 Final[(r + parts).lower()] = {"mark": points,
                                               "comment": "Program ran and output matched."}
-        # # Reset Points
-        # total = 0
-        # points = 0
-        # for tests in test_dict[r]["Part2"].keys():
-        #     p = subprocess.Popen(tests,
-        #                          shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-        #     stdout_data, stderr_data = p.communicate()
-        #     total = total + test_dict[r]["Part2"][tests]
-        #     if(p.returncode != 0):
-        #         Error += "*"*20+tests+"*"*20
-        #         Error += "\n" + stdout_data.decode()
-        #     else:
-        #         points += test_dict[r]["Part2"][tests]
-        #         Success += "*"*20+tests+"*"*20
-        #         Success += "\n" + stdout_data.decode()
-
-        # if points < total/2:
-        #     Final[r + "-P2"] = {"mark": points,
-        #                         "comment": "Program did not run successfully. It either did not build or exited with error code 0"}
-        # elif points < total:
-        #     Final[r + "-P2"] = {"mark": points,
-        #                         "comment": "Program ran, but output did not match. see log file"}
-        # else:
-        #     Final[r+"-P2"] = {"mark": points,
-        #
-        #              "comment": "Program ran and output matched."}
+    if opts.cache:
+        save_cache(cache)
+
+    with open(os.path.join(output_folder, "timing.json"), "w") as f:
+        json.dump({"wall_seconds": round(wall_seconds, 6), "jobs": opts.jobs,
+                   "tests": timing}, f, indent=2)
+
     githubprefix = os.path.basename(os.getcwd())
     Final["userid"] = "GithubID:" + githubprefix
     j = json.dumps(Final, indent=2)
@@ -1,259 +1,210 @@
 #include <stdio.h> // for stderr
 #include <stdlib.h> // for exit()
+#include <string.h> // for memmove()
+#include <time.h> // for clock_gettime()
 #include "types.h"
 #include "utils.h"
 #include "riscv.h"
+#include "bpred.h"
+#include "block.h"
+#include "memtrace.h"
+#include "replay.h"
+#include "mmio.h"
+#include "trap.h"
+#include "superblock.h"
+#include "machine.h"
+#include "psimd.h"
+#include "vector.h"
+#include "isa.h"
 
-void execute_rtype(Instruction, Processor *);
-void execute_itype_except_load(Instruction, Processor *);
-void execute_branch(Instruction, Processor *);
+void execute_branch(Instruction, Processor *, int);
 void execute_jal(Instruction, Processor *);
-void execute_load(Instruction, Processor *, Byte *);
-void execute_store(Instruction, Processor *, Byte *);
+void execute_load(Instruction, Processor *, Byte *, Alignment);
+void execute_store(Instruction, Processor *, Byte *, Alignment);
 void execute_ecall(Processor *, Byte *);
-void execute_lui(Instruction, Processor *);
-void execute_custom(Instruction, Processor *);
+void execute_csr(Instruction, Processor *);
 
+#define RD processor->R[instruction.rtype.rd]
+#define RS1 processor->R[instruction.rtype.rs1]
+#define RS2 processor->R[instruction.rtype.rs2]
+#define IMM isa_imm_i(instruction.bits)
+
+/* One switch on the op the decode table (isa.h) gives, the same op the
+   pre-decoder picks its handler by (decode.c), so both paths see the same
+   encodings as valid. Bad encodings of known opcodes stop the machine. */
 void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *memory) {    
     Instruction instruction = parse_instruction(instruction_bits);
-    switch(instruction.opcode) {
-        case 0x33:
-            execute_rtype(instruction, processor);
-            break;
-        case 0x13:
-            execute_itype_except_load(instruction, processor);
-            break;
-        case 0x73:
-            execute_ecall(processor, memory);
-            break;
-        case 0x63:
-            execute_branch(instruction, processor);
-            break;
-        case 0x6F:
-            execute_jal(instruction, processor);
-            break;
-        case 0x23:
-            execute_store(instruction, processor, memory);
-            break;
-        case 0x03:
-            execute_load(instruction, processor, memory);
-            break;
-        case 0x37:
-            execute_lui(instruction, processor);
-            break;
-        case 0x2b:
-            execute_custom(instruction, processor);
-            break;
-        default: // undefined opcode
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
-    }
-}
+    IsaOp op = isa_decode(instruction_bits);
 
-void execute_rtype(Instruction instruction, Processor *processor) {
-    switch (instruction.rtype.funct3) {
-        case 0x0:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                  // Add
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) +
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;
-                    break;
-                case 0x1:
-                  // Mul
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) *
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;
-                    break;
-                case 0x20:
-                    // Sub
-                    processor->R[instruction.rtype.rd] = 
-                        ((sWord)processor->R[instruction.rtype.rs1]) -
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
-            }
-            break;
-        case 0x1:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                    // SLL
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) <<
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;
-                    break;
-                case 0x1:
-                    // MULH
-                    processor->R[instruction.rtype.rd] = (sWord)((((sDouble)processor->R[instruction.rtype.rs1]) * ((sDouble)processor->R[instruction.rtype.rs2])) >> 32);
-                    processor->PC += 4;
-                    break;
+    switch (op) {
+        /* R-type */
+        case ISA_ADD: RD = ((sWord)RS1) + ((sWord)RS2); break;
+        case ISA_MUL: RD = ((sWord)RS1) * ((sWord)RS2); break;
+        case ISA_SUB: RD = ((sWord)RS1) - ((sWord)RS2); break;
+        case ISA_SLL: RD = ((sWord)RS1) << ((sWord)RS2); break;
+        case ISA_MULH: RD = (sWord)((((sDouble)RS1) * ((sDouble)RS2)) >> 32); break;
+        case ISA_SLT: RD = (((sWord)RS1) < ((sWord)RS2)) ? 1 : 0; break;
+        case ISA_XOR: RD = ((sWord)RS1) ^ ((sWord)RS2); break;
+        case ISA_DIV: RD = riscv_div(RS1, RS2); break;
+        case ISA_SRL: RD = ((Word)RS1) >> ((sWord)RS2); break;
+        case ISA_SRA: RD = ((sWord)RS1) >> ((sWord)RS2); break;
+        case ISA_OR: RD = ((sWord)RS1) | ((sWord)RS2); break;
+        case ISA_REM: RD = riscv_rem(RS1, RS2); break;
+        case ISA_AND: RD = ((sWord)RS1) & ((sWord)RS2); break;
+
+        /* I-type; XORI does not sign-extend its immediate */
+        case ISA_ADDI: RD = ((sWord)RS1) + IMM; break;
+        case ISA_SLLI: RD = ((sWord)RS1) << (IMM & 0x1F); break;
+        case ISA_SLTI: RD = ((sWord)RS1) < IMM ? 1U : 0U; break;
+        case ISA_XORI: RD = ((sWord)RS1) ^ (instruction.bits >> 20); break;
+        case ISA_ORI: RD = ((sWord)RS1) | IMM; break;
+        case ISA_ANDI: RD = ((sWord)RS1) & IMM; break;
+        /* the table only looks at imm[11:10]; the rest of funct7 is zero */
+        case ISA_SRLI:
+            if ((instruction.bits >> 25) != 0x00) {
+                goto invalid;
             }
+            RD = ((Word)RS1) >> (IMM & 0x1F);
             break;
-        case 0x2:
-            // SLT
-            processor->R[instruction.rtype.rd] =
-                (((sWord)processor->R[instruction.rtype.rs1]) <
-                ((sWord)processor->R[instruction.rtype.rs2])) ? 1 : 0;
-            processor->PC += 4;
-            break;
-        case 0x4:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                    // XOR
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) ^
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;
-                    break;
-                case 0x1:
-                    // DIV
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) /
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
+        case ISA_SRAI:
+            if ((instruction.bits >> 25) != 0x20) {
+                goto invalid;
             }
+            RD = ((sWord)RS1) >> (IMM & 0x1F);
             break;
-        case 0x5:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                    // SRL
-                    processor->R[instruction.rtype.rd] =
-                        ((Word)processor->R[instruction.rtype.rs1]) >>
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;      
-                    break;
-                case 0x20:
-                    // SRA
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) >>
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;  
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                break;
-            }
+
+        case ISA_LB ... ISA_LW:
+            execute_load(instruction, processor, memory,
+                         1U << (op - ISA_LB));
+            return;
+        case ISA_SB ... ISA_SW:
+            execute_store(instruction, processor, memory,
+                          1U << (op - ISA_SB));
+            return;
+        case ISA_BEQ:
+            execute_branch(instruction, processor, RS1 == RS2);
+            return;
+        case ISA_BNE:
+            execute_branch(instruction, processor, RS1 != RS2);
+            return;
+        case ISA_JAL:
+            execute_jal(instruction, processor);
+            return;
+        case ISA_LUI:
+            RD = isa_imm_u(instruction.bits);
             break;
-        case 0x6:
-            switch (instruction.rtype.funct7) {
-                case 0x0:
-                    // OR
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) |
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;  
-                    break;
-                case 0x1:
-                    // REM
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) %
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    processor->PC += 4;  
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
+
+        case ISA_ECALL:
+            if (instruction.bits == INSTRUCTION_MRET) {
+                trap_mret(processor);
+            } else if (instruction.bits == INSTRUCTION_WFI) {
+                trap_wfi(processor, processor->instret);
+            } else {
+                execute_ecall(processor, memory);
             }
+            return;
+        case ISA_CSRRW ... ISA_CSRRCI:
+            execute_csr(instruction, processor);
+            return;
+
+        /* custom */
+        case ISA_MAC: RD = ((sWord)RD) + (((sWord)RS1) * ((sWord)RS2)); break;
+        case ISA_ACC: RD = ((sWord)RD) + (((sWord)RS1) + ((sWord)RS2)); break;
+        case ISA_GEP: RD = ((sWord)RS1) + (((sWord)RS2) << 4); break;
+        case ISA_ADD8 ... ISA_MAX16:
+            // packed SIMD, see psimd.h; the ops are in funct7 order
+            RD = psimd_execute(op - ISA_ADD8, RD, RS1, RS2);
             break;
-        case 0x7:
-            // AND
-            processor->R[instruction.rtype.rd] =
-                ((sWord)processor->R[instruction.rtype.rs1]) &
-                ((sWord)processor->R[instruction.rtype.rs2]);
-            processor->PC += 4;
-            break;
+
+        case ISA_VECTOR:
+            execute_vector(instruction.bits, processor, memory);
+            return;
+
+        case ISA_INVALID:
         default:
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
+            if (!is_valid_opcode(instruction.opcode)) {
+                processor->status = MACHINE_UNKNOWN_OPCODE;
+                return;
+            }
+            goto invalid;
     }
+    processor->PC += 4;
+    return;
+
+invalid:
+    handle_invalid_instruction(instruction);
+    processor->status = MACHINE_INVALID_INSTRUCTION;
 }
 
-void execute_itype_except_load(Instruction instruction, Processor *processor) {
-    switch (instruction.itype.funct3) {
-        case 0x0:
-            // ADDI
-            processor->R[instruction.itype.rd] =
-                ((sWord)processor->R[instruction.itype.rs1]) +
-                (sign_extend_number(instruction.itype.imm, 12));
-            processor->PC += 4;  
-            break;
-        case 0x1:
-            // SLLI
-            processor->R[instruction.itype.rd] =
-                ((sWord)processor->R[instruction.itype.rs1]) <<
-                ((sWord)(instruction.itype.imm & 0x1F));
-            processor->PC += 4;  
-            break;
-        case 0x2:
-            // STLI
-            processor->R[instruction.itype.rd] = 
-                ((sWord)processor->R[instruction.itype.rs1]) <
-                (sign_extend_number(instruction.itype.imm, 12)) ? 1U : 0U;
-            processor->PC += 4;  
-            break;
-        case 0x4:
-            // XORI
-            processor->R[instruction.itype.rd] =
-                ((sWord)processor->R[instruction.itype.rs1]) ^
-                (instruction.itype.imm);
-            processor->PC += 4;  
-            break;
-        case 0x5:
-            // Shift Right (You must handle both logical and arithmetic)
-            switch ((instruction.itype.imm >> 5) & 0x7F) {
-                case 0x00:
-                    processor->R[instruction.itype.rd] =
-                        ((Word)processor->R[instruction.itype.rs1]) >>
-                        ((sWord)(instruction.itype.imm & 0x1F));
-                    processor->PC += 4;  
-                    break;
-                case 0x20:
-                    processor->R[instruction.itype.rd] =
-                        ((sWord)processor->R[instruction.itype.rs1]) >>
-                        ((sWord)instruction.itype.imm & 0x1F);
-                    processor->PC += 4;  
-                    break;
-                default:
-                    handle_invalid_instruction(instruction);
-                    exit(-1);
-                    break;
-            }
-            break;
-        case 0x6:
-            // ORI
-            processor->R[instruction.itype.rd] =
-                ((sWord)processor->R[instruction.itype.rs1]) |
-                (sign_extend_number(instruction.itype.imm, 12));
-            processor->PC += 4;  
-            break;
-        case 0x7:
-            // ANDI
-            processor->R[instruction.itype.rd] =
-                ((sWord)processor->R[instruction.itype.rs1]) &
-                (sign_extend_number(instruction.itype.imm, 12));
-            processor->PC += 4;  
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
+#undef RD
+#undef RS1
+#undef RS2
+#undef IMM
+
+/* Records a bulk access in word-sized pieces, the way a loop would */
+static void trace_range(Processor *p, Address address, Word length,
+                        int is_write) {
+    Word i;
+    Alignment piece;
+    for (i = 0; p->memtrace && i < length; i += piece) {
+        piece = length - i < LENGTH_WORD ? LENGTH_BYTE : LENGTH_WORD;
+        memtrace_access(p, address + i, piece, is_write);
+    }
+}
+
+/* ECALL_MEMCPY, ECALL_MEMMOVE and ECALL_MEMSET; returns 0 on a bad range */
+static int execute_bulk(Processor *p, Byte *memory) {
+    Address dst = p->R[11], src = p->R[12];
+    Word length = p->R[13];
+
+    if (!in_memory(dst, length)) {
+        printf("Bad Write. Address: 0x%08x\n", dst);
+        return 0;
+    }
+    if (p->R[10] == ECALL_MEMSET) {
+        trace_range(p, dst, length, 1);
+        memset(memory + dst, src & 0xFF, length);
+    } else {
+        if (!in_memory(src, length)) {
+            printf("Bad Read. Address: 0x%08x\n", src);
+            return 0;
+        }
+        trace_range(p, src, length, 0);
+        trace_range(p, dst, length, 1);
+        memmove(memory + dst, memory + src, length);
     }
+    if (length > 0) {
+        memory_dirty(memory, dst, length);
+        sb_check_range(p->sb, dst, length);
+    }
+    return 1;
+}
+
+/* ECALL_BLOCK_READ and ECALL_BLOCK_WRITE: the descriptor goes to the block
+   device's registers as stores would, and a rejected one faults with the
+   same diagnostic; returns 0 if the device rejects it */
+static int execute_block(Processor *p, Byte *memory) {
+    Address registers[] = {BLOCK_BASE + BLOCK_ADDRESS, BLOCK_BASE + BLOCK_SECTOR,
+                           BLOCK_BASE + BLOCK_COUNT, BLOCK_BASE + BLOCK_COMMAND};
+    Word values[] = {p->R[11], p->R[12], p->R[13],
+                     p->R[10] == ECALL_BLOCK_READ ? BLOCK_READ : BLOCK_WRITE};
+    Word status;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (!mmio_store(p, memory, registers[i], LENGTH_WORD, p->instret,
+                        values[i])) {
+            printf("Bad Write. Address: 0x%08x\n", registers[i]);
+            return 0;
+        }
+    }
+    if (!mmio_load(p, memory, BLOCK_BASE + BLOCK_STATUS, LENGTH_WORD,
+                   p->instret, &status)) {
+        printf("Bad Read. Address: 0x%08x\n", BLOCK_BASE + BLOCK_STATUS);
+        return 0;
+    }
+    p->R[10] = status;
+    return 1;
 }
 
 void execute_ecall(Processor *p, Byte *memory) {
@@ -272,169 +223,192 @@ void execute_ecall(Processor *p, Byte *memory) {
             break;
         case 10: // exit
             printf("exiting the simulator\n");
-            exit(0);
-            break;
+            p->status = MACHINE_EXITED;
+            return;
         case 11: // print a character
             printf("%c",p->R[11]);
             break;
+        case ECALL_MEMCPY:
+        case ECALL_MEMSET:
+        case ECALL_MEMMOVE:
+            if (!execute_bulk(p, memory)) {
+                p->status = MACHINE_ACCESS_FAULT;
+                return;
+            }
+            p->R[10] = p->R[11];
+            break;
+        case ECALL_BLOCK_READ:
+        case ECALL_BLOCK_WRITE:
+            if (!execute_block(p, memory)) {
+                p->status = MACHINE_ACCESS_FAULT;
+                return;
+            }
+            break;
         default: // undefined ecall
             printf("Illegal ecall number %d\n", p->R[10]);
-            exit(-1);
-            break;
+            p->status = MACHINE_ILLEGAL_ECALL;
+            return;
     }
     p->PC += 4;
 }
 
-void execute_branch(Instruction instruction, Processor *processor) {
-    switch (instruction.sbtype.funct3) {
-        case 0x0:
-            // BEQ
-            if (processor->R[instruction.sbtype.rs1] == processor->R[instruction.sbtype.rs2]) {
-                processor->PC += get_branch_offset(instruction);
-            } else {
-                processor->PC += 4;
-            }
+Double host_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Double)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int read_csr(const Processor *p, Word csr, Double instret, Register *value) {
+    Double counter;
+
+    switch (csr) {
+        case CSR_VL:
+            *value = p->V.vl;
+            return 1;
+        case CSR_VTYPE:
+            *value = p->V.vtype;
+            return 1;
+        case CSR_VLENB:
+            *value = VLENB;
+            return 1;
+    }
+    if (trap_read_csr(p, csr, instret, value)) {
+        return 1;
+    }
+    switch (csr & ~0x80U) {
+        case CSR_CYCLE:
+            counter = trap_mtime(p, instret);
             break;
-        case 0x1:
-            // BNE
-            if (processor->R[instruction.sbtype.rs1] != processor->R[instruction.sbtype.rs2]) {
-                processor->PC += get_branch_offset(instruction);
-            } else {
-                processor->PC += 4;
+        case CSR_INSTRET:
+            counter = instret;
+            break;
+        case CSR_TIME:
+            if (p->replay && replay_take(p->replay, REPLAY_TIME, instret,
+                                         &counter)) {
+                break;
+            }
+            counter = (host_clock_ns() - p->time_base) /
+                      (1000000000 / CSR_TIMEBASE_HZ);
+            if (p->replay) {
+                replay_log(p->replay, REPLAY_TIME, instret, counter);
             }
             break;
         default:
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
+            return 0;
     }
+    *value = (csr & 0x80) ? (Register)(counter >> 32) : (Register)counter;
+    return 1;
 }
 
-void execute_load(Instruction instruction, Processor *processor, Byte *memory) {
-    switch (instruction.itype.funct3) {
-        int data;
-        case 0x0:
-            // LB
-            data = load(
-                memory,
-                sign_extend_number(((sWord)(instruction.itype.imm)), 12) + ((sWord)processor->R[(instruction.itype.rs1)]),
-                LENGTH_BYTE
-            );
-
-            processor->R[instruction.itype.rd] = data;
-            processor->PC += 4; 
-            break;
-        case 0x1:
-            // LH
-            data = load(
-                memory,
-                sign_extend_number(((sWord)(instruction.itype.imm)), 12) + ((sWord)processor->R[(instruction.itype.rs1)]),
-                LENGTH_HALF_WORD
-            );
-
-            processor->R[instruction.itype.rd] = data;
-            processor->PC += 4; 
-            break;
-        case 0x2:
-            // LW
-            data = load(
-                memory,
-                sign_extend_number(((sWord)(instruction.itype.imm)), 12) + ((sWord)processor->R[(instruction.itype.rs1)]),
-                LENGTH_WORD
-            );
-
-            processor->R[instruction.itype.rd] = sign_extend_number(data, LENGTH_WORD);
-            processor->PC += 4; 
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
+int csr_writes(Word instruction_bits) {
+    Word funct3 = (instruction_bits >> 12) & 0x3;
+    Word rs1 = (instruction_bits >> 15) & 0x1F;
+    return funct3 == 0x1 || rs1 != 0;
+}
+
+int write_csr(Processor *p, Word csr, Register value) {
+    // counters and vector state are read-only
+    return trap_write_csr(p, csr, value);
+}
+
+void execute_csr(Instruction instruction, Processor *processor) {
+    Register value, source;
+
+    // the immediate forms put a 5-bit unsigned immediate in rs1
+    source = (instruction.itype.funct3 & 0x4) ? instruction.itype.rs1
+                                              : processor->R[instruction.itype.rs1];
+    if (!read_csr(processor, instruction.itype.imm, processor->instret, &value) ||
+        (csr_writes(instruction.bits) &&
+         !write_csr(processor, instruction.itype.imm,
+                    (instruction.itype.funct3 & 0x3) == 0x1 ? source
+                    : (instruction.itype.funct3 & 0x3) == 0x2 ? value | source
+                    : value & ~source))) {
+        handle_invalid_instruction(instruction);
+        processor->status = MACHINE_INVALID_INSTRUCTION;
+        return;
     }
+    processor->R[instruction.itype.rd] = value;
+    processor->PC += 4;
 }
 
-void execute_store(Instruction instruction, Processor *processor, Byte *memory) {
-    switch (instruction.stype.funct3) {
-        case 0x0:
-            // SB
-            store(
-                memory,
-                get_store_offset(instruction) + (sWord)processor->R[instruction.stype.rs1],
-                LENGTH_BYTE,
-                (Word)processor->R[instruction.stype.rs2]
-            );
-            processor->PC += 4;
-            break;
-        case 0x1:
-            // SH
-            store(
-                memory,
-                get_store_offset(instruction) + (sWord)processor->R[instruction.stype.rs1],
-                LENGTH_HALF_WORD,
-                (Word)processor->R[instruction.stype.rs2]
-            );
-            processor->PC += 4;
-            break;
-        case 0x2:
-            // SW
-            store(
-                memory,
-                get_store_offset(instruction) + (sWord)processor->R[instruction.stype.rs1],
-                LENGTH_WORD,
-                (Word)processor->R[instruction.stype.rs2]
-            );
-            processor->PC += 4;
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            exit(-1);
-            break;
+void execute_branch(Instruction instruction, Processor *processor, int taken) {
+    if (processor->bpred) {
+        bpred_record(processor->bpred, processor->PC, BRANCH_CONDITIONAL, taken,
+                     processor->PC + get_branch_offset(instruction));
+    }
+
+    if (taken) {
+        processor->PC += get_branch_offset(instruction);
+    } else {
+        processor->PC += 4;
     }
 }
 
-void execute_jal(Instruction instruction, Processor *processor) {
-    /* YOUR CODE HERE */
-    processor->R[instruction.ujtype.rd] = processor->PC + 4;
-    processor->PC += get_jump_offset(instruction);
+/* A load or store outside guest memory: a device (mmio.h), or a fault */
+static void execute_outside(Instruction instruction, Processor *processor,
+                            Byte *memory, Address address, Alignment length,
+                            int is_write) {
+    Word value;
+
+    memtrace_access(processor, address, length, is_write);
+    if (is_write ? !mmio_store(processor, memory, address, length,
+                               processor->instret,
+                               processor->R[instruction.stype.rs2])
+                 : !mmio_load(processor, memory, address, length,
+                              processor->instret, &value)) {
+        printf(is_write ? "Bad Write. Address: 0x%08x\n"
+                        : "Bad Read. Address: 0x%08x\n", address);
+        processor->status = MACHINE_ACCESS_FAULT;
+        return;
+    }
+    if (!is_write) {
+        // devices extend bytes and halves themselves (mmio_extend)
+        processor->R[instruction.itype.rd] = value;
+    }
+    processor->PC += 4;
 }
 
-void execute_lui(Instruction instruction, Processor *processor) {
-    // processor->R[instruction.utype.rd] = ((sWord)processor->R[instruction.utype.imm]) << 11;
-    // processor->PC += 4; 
-    int x = instruction.utype.rd;
-    int upperImm = ((sWord)instruction.utype.imm) << 12;
-    processor->R[x] = upperImm;
+void execute_load(Instruction instruction, Processor *processor, Byte *memory,
+                  Alignment length) {
+    Address address = sign_extend_number(((sWord)(instruction.itype.imm)), 12) + ((sWord)processor->R[(instruction.itype.rs1)]);
+    Word data;
+
+    if (mmio_outside(address, length)) {
+        execute_outside(instruction, processor, memory, address, length, 0);
+        return;
+    }
+    memtrace_access(processor, address, length, 0);
+    data = load(memory, address, length);
+    processor->R[instruction.itype.rd] =
+        length == LENGTH_WORD ? (Word)sign_extend_number(data, LENGTH_WORD) : data;
     processor->PC += 4;
 }
 
-void execute_custom(Instruction instruction, Processor *processor) {
-    switch(instruction.rtype.funct3) {
-        case 0x0:
-          // Mac
-            processor->R[instruction.rtype.rd] = 
-                ((sWord)processor->R[instruction.rtype.rd]) +
-                (((sWord)processor->R[instruction.rtype.rs1]) *
-                ((sWord)processor->R[instruction.rtype.rs2]));
-            processor->PC += 4;
-            break;
-        case 0x1:
-          // Acc
-            processor->R[instruction.rtype.rd] = 
-                ((sWord)processor->R[instruction.rtype.rd]) +
-                (((sWord)processor->R[instruction.rtype.rs1]) +
-                ((sWord)processor->R[instruction.rtype.rs2]));
-            processor->PC += 4;
-            break;
-        case 0x2:
-          // Gep
-            processor->R[instruction.rtype.rd] = 
-                ((sWord)processor->R[instruction.rtype.rs1]) +
-                (((sWord)processor->R[instruction.rtype.rs2]) << 4);
-            processor->PC += 4;
-            break;
-        default:
-            handle_invalid_instruction(instruction);
-            break;
-    }   
+void execute_store(Instruction instruction, Processor *processor, Byte *memory,
+                   Alignment length) {
+    Address address = get_store_offset(instruction) + (sWord)processor->R[instruction.stype.rs1];
+
+    if (mmio_outside(address, length)) {
+        execute_outside(instruction, processor, memory, address, length, 1);
+        return;
+    }
+    memtrace_access(processor, address, length, 1);
+    store(memory, address, length, (Word)processor->R[instruction.stype.rs2]);
+    sb_check_store(processor->sb, address, length);
+    processor->PC += 4;
+}
+
+void execute_jal(Instruction instruction, Processor *processor) {
+    /* YOUR CODE HERE */
+    if (processor->bpred) {
+        // x1 (ra) and x5 (t0) are the link registers of the calling convention
+        BranchKind kind = (instruction.ujtype.rd == 1 || instruction.ujtype.rd == 5)
+            ? BRANCH_CALL : BRANCH_JUMP;
+        bpred_record(processor->bpred, processor->PC, kind, 1,
+                     processor->PC + get_jump_offset(instruction));
+    }
+    processor->R[instruction.ujtype.rd] = processor->PC + 4;
+    processor->PC += get_jump_offset(instruction);
 }
 
 void store(Byte *memory, Address address, Alignment alignment, Word value) {
@@ -457,7 +431,17 @@ void store(Byte *memory, Address address, Alignment alignment, Word value) {
     } else {
         *(addr) = chunk1;
     }
+    memory_dirty(memory, address, alignment);
+}
 
+int fetch(Processor *p, Byte *memory, Word *instruction_bits) {
+    if (!in_memory(p->PC, LENGTH_WORD)) {
+        printf("Bad Read. Address: 0x%08x\n", p->PC);
+        p->status = MACHINE_ACCESS_FAULT;
+        return 0;
+    }
+    *instruction_bits = load(memory, p->PC, LENGTH_WORD);
+    return 1;
 }
 
 Word load(Byte *memory, Address address, Alignment alignment) {
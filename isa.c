@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include "isa.h"
+
+#define ISA_INFO(op, mnemonic, format) \
+    [ISA_##op] = {mnemonic, ISA_FMT_##format},
+const IsaInfo isa_info[ISA_COUNT] = { ISA_OPS(ISA_INFO) };
+#undef ISA_INFO
+
+const Byte isa_opcode_class[128] = {
+    [0x33] = ISA_CLASS_R,      [0x13] = ISA_CLASS_I,
+    [0x03] = ISA_CLASS_LOAD,   [0x23] = ISA_CLASS_STORE,
+    [0x63] = ISA_CLASS_BRANCH, [0x37] = ISA_CLASS_LUI,
+    [0x6F] = ISA_CLASS_JAL,    [0x73] = ISA_CLASS_ECALL,
+    [0x2b] = ISA_CLASS_CUSTOM, [0x07] = ISA_CLASS_VECTOR,
+    [0x27] = ISA_CLASS_VECTOR, [0x57] = ISA_CLASS_VECTOR,
+};
+
+/* empty slots are ISA_INVALID */
+#define ANY(op) {ISA_##op, ISA_##op, ISA_##op, ISA_##op}
+#define BY_FUNCT7(a, b, c) {ISA_##a, ISA_##b, ISA_##c, ISA_INVALID}
+
+const Byte isa_table[ISA_CLASS_COUNT][8][4] = {
+    [ISA_CLASS_R] = {
+        [0x0] = BY_FUNCT7(ADD, MUL, SUB),
+        [0x1] = BY_FUNCT7(SLL, MULH, INVALID),
+        [0x2] = ANY(SLT),
+        [0x4] = BY_FUNCT7(XOR, DIV, INVALID),
+        [0x5] = BY_FUNCT7(SRL, INVALID, SRA),
+        [0x6] = BY_FUNCT7(OR, REM, INVALID),
+        [0x7] = ANY(AND),
+    },
+    [ISA_CLASS_I] = {
+        [0x0] = ANY(ADDI),
+        [0x1] = ANY(SLLI),
+        [0x2] = ANY(SLTI),
+        [0x4] = ANY(XORI),
+        [0x5] = {ISA_SRLI, ISA_SRAI},
+        [0x6] = ANY(ORI),
+        [0x7] = ANY(ANDI),
+    },
+    [ISA_CLASS_LOAD] = {
+        [0x0] = ANY(LB),
+        [0x1] = ANY(LH),
+        [0x2] = ANY(LW),
+    },
+    [ISA_CLASS_STORE] = {
+        [0x0] = ANY(SB),
+        [0x1] = ANY(SH),
+        [0x2] = ANY(SW),
+    },
+    [ISA_CLASS_BRANCH] = {
+        [0x0] = ANY(BEQ),
+        [0x1] = ANY(BNE),
+    },
+    [ISA_CLASS_LUI] = {
+        [0 ... 7] = ANY(LUI),
+    },
+    [ISA_CLASS_JAL] = {
+        [0 ... 7] = ANY(JAL),
+    },
+    [ISA_CLASS_ECALL] = {
+        [0x0] = ANY(ECALL),
+        [0x1] = ANY(CSRRW),
+        [0x2] = ANY(CSRRS),
+        [0x3] = ANY(CSRRC),
+        [0x4] = ANY(ECALL),
+        [0x5] = ANY(CSRRWI),
+        [0x6] = ANY(CSRRSI),
+        [0x7] = ANY(CSRRCI),
+    },
+    [ISA_CLASS_CUSTOM] = {
+        [0x0] = ANY(MAC),
+        [0x1] = ANY(ACC),
+        [0x2] = ANY(GEP),
+    },
+    [ISA_CLASS_VECTOR] = {
+        [0 ... 7] = ANY(VECTOR),
+    },
+};
@@ -0,0 +1,172 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include "types.h"
+#include "psimd.h"
+
+/* The instruction set as data. Every encoding the emulator knows is one
+   line of ISA_OPS and one slot of isa_table, indexed by opcode class,
+   funct3 and a selector; the disassembler formats from it (riscv.h) and
+   the pre-decoder maps each op to a handler (decode.h) and the reference
+   interpreter switches on it (execute_instruction() in emulator.c). Adding
+   an instruction means a table entry, a handler and a case; which
+   encodings are valid is decided here alone.
+
+   The selector is funct7 bucketed as 0x00, 0x01, 0x20 or other for R-type
+   and custom, and imm[11:10] for I-type; other classes fill all four.
+   Packed SIMD needs the whole of funct7 and is resolved by isa_lookup(). */
+
+/* how the disassembler formats an op */
+typedef enum {
+    ISA_FMT_INVALID = 0, /* "Invalid Instruction" line */
+    ISA_FMT_R,
+    ISA_FMT_I,
+    ISA_FMT_LOAD,
+    ISA_FMT_STORE,
+    ISA_FMT_BRANCH,
+    ISA_FMT_LUI,
+    ISA_FMT_JAL,
+    ISA_FMT_ECALL, /* ecall, mret or wfi by the whole word */
+    ISA_FMT_CSR,
+    ISA_FMT_CSRI,
+    ISA_FMT_VECTOR, /* formatted by vector_format() */
+} IsaFormat;
+
+/* op, mnemonic, format; the packed SIMD ops are in funct7 order */
+#define ISA_OPS(X)                    \
+    X(INVALID, NULL, INVALID)         \
+    X(ADD, "add", R)                  \
+    X(MUL, "mul", R)                  \
+    X(SUB, "sub", R)                  \
+    X(SLL, "sll", R)                  \
+    X(MULH, "mulh", R)                \
+    X(SLT, "slt", R)                  \
+    X(XOR, "xor", R)                  \
+    X(DIV, "div", R)                  \
+    X(SRL, "srl", R)                  \
+    X(SRA, "sra", R)                  \
+    X(OR, "or", R)                    \
+    X(REM, "rem", R)                  \
+    X(AND, "and", R)                  \
+    X(ADDI, "addi", I)                \
+    X(SLLI, "slli", I)                \
+    X(SLTI, "slti", I)                \
+    X(XORI, "xori", I)                \
+    X(SRLI, "srli", I)                \
+    X(SRAI, "srai", I)                \
+    X(ORI, "ori", I)                  \
+    X(ANDI, "andi", I)                \
+    X(LB, "lb", LOAD)                 \
+    X(LH, "lh", LOAD)                 \
+    X(LW, "lw", LOAD)                 \
+    X(SB, "sb", STORE)                \
+    X(SH, "sh", STORE)                \
+    X(SW, "sw", STORE)                \
+    X(BEQ, "beq", BRANCH)             \
+    X(BNE, "bne", BRANCH)             \
+    X(LUI, "lui", LUI)                \
+    X(JAL, "jal", JAL)                \
+    X(ECALL, "ecall", ECALL)          \
+    X(CSRRW, "csrrw", CSR)            \
+    X(CSRRS, "csrrs", CSR)            \
+    X(CSRRC, "csrrc", CSR)            \
+    X(CSRRWI, "csrrwi", CSRI)         \
+    X(CSRRSI, "csrrsi", CSRI)         \
+    X(CSRRCI, "csrrci", CSRI)         \
+    X(MAC, "mac", R)                  \
+    X(ACC, "acc", R)                  \
+    X(GEP, "gep", R)                  \
+    X(ADD8, "add8", R)                \
+    X(ADD16, "add16", R)              \
+    X(SUB8, "sub8", R)                \
+    X(SUB16, "sub16", R)              \
+    X(KADD8, "kadd8", R)              \
+    X(KADD16, "kadd16", R)            \
+    X(MAC8, "mac8", R)                \
+    X(MAC16, "mac16", R)              \
+    X(DOT8, "dot8", R)                \
+    X(DOT16, "dot16", R)              \
+    X(MIN8, "min8", R)                \
+    X(MIN16, "min16", R)              \
+    X(MAX8, "max8", R)                \
+    X(MAX16, "max16", R)              \
+    X(VECTOR, NULL, VECTOR)
+
+#define ISA_ENUM(op, mnemonic, format) ISA_##op,
+typedef enum { ISA_OPS(ISA_ENUM) ISA_COUNT } IsaOp;
+#undef ISA_ENUM
+
+typedef struct {
+    const char *mnemonic;
+    IsaFormat format;
+} IsaInfo;
+
+/* opcode classes; ISA_CLASS_UNKNOWN opcodes stop execution and the
+   disassembly listing */
+enum {
+    ISA_CLASS_UNKNOWN = 0,
+    ISA_CLASS_R,
+    ISA_CLASS_I,
+    ISA_CLASS_LOAD,
+    ISA_CLASS_STORE,
+    ISA_CLASS_BRANCH,
+    ISA_CLASS_LUI,
+    ISA_CLASS_JAL,
+    ISA_CLASS_ECALL,
+    ISA_CLASS_CUSTOM,
+    ISA_CLASS_VECTOR,
+    ISA_CLASS_COUNT
+};
+
+extern const Byte isa_opcode_class[128];
+extern const Byte isa_table[ISA_CLASS_COUNT][8][4];
+extern const IsaInfo isa_info[ISA_COUNT];
+
+static inline Word isa_funct7_bucket(Word funct7) {
+    return funct7 == 0x0 ? 0 : funct7 == 0x1 ? 1 : funct7 == 0x20 ? 2 : 3;
+}
+
+/* The op for word w of class cls, given its funct3 and funct7 bucket, for
+   callers that have those already (the disassembler's batch keys) */
+static inline IsaOp isa_lookup(Word cls, Word funct3, Word bucket, Word w) {
+    if (cls == ISA_CLASS_I) {
+        return isa_table[cls][funct3][w >> 30];
+    }
+    if (cls == ISA_CLASS_CUSTOM && funct3 == PSIMD_FUNCT3) {
+        return (w >> 25) < PSIMD_COUNT ? ISA_ADD8 + (w >> 25) : ISA_INVALID;
+    }
+    return isa_table[cls][funct3][bucket];
+}
+
+/* ISA_INVALID for unknown opcodes as well as bad encodings of known ones */
+static inline IsaOp isa_decode(Word w) {
+    return isa_lookup(isa_opcode_class[w & 0x7F], (w >> 12) & 0x7,
+                      isa_funct7_bucket(w >> 25), w);
+}
+
+/* Sign-extended immediates by format, straight from the instruction word:
+   each is a mask and a shift or two per scattered field, with the sign
+   taken from bit 31 by an arithmetic shift */
+static inline sWord isa_imm_i(Word w) {
+    return (sWord)w >> 20;
+}
+
+static inline sWord isa_imm_s(Word w) {
+    return ((sWord)(w & 0xFE000000) >> 20) | ((w >> 7) & 0x1F);
+}
+
+static inline sWord isa_imm_b(Word w) {
+    return ((sWord)(w & 0x80000000) >> 19) | ((w << 4) & 0x800) |
+           ((w >> 20) & 0x7E0) | ((w >> 7) & 0x1E);
+}
+
+static inline sWord isa_imm_u(Word w) {
+    return (sWord)(w & 0xFFFFF000);
+}
+
+static inline sWord isa_imm_j(Word w) {
+    return ((sWord)(w & 0x80000000) >> 11) | (w & 0xFF000) |
+           ((w >> 9) & 0x800) | ((w >> 20) & 0x7FE);
+}
+
+#endif
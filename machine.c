@@ -0,0 +1,427 @@
+#define _GNU_SOURCE /* cpu_set_t, MAP_HUGETLB */
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "machine.h"
+#include "riscv.h"
+#include "trap.h"
+#include "vector.h"
+
+#define MAX_LINE 50
+
+/* An untouched mapping for memory: whole huge pages on a huge page
+   boundary unless pages is MACHINE_PAGES_SMALL. Sets *mapped to its length;
+   returns NULL if the mapping fails. */
+static Byte *map_memory(MachinePages pages, size_t *mapped) {
+    size_t length = MEMORY_SPACE + MEMORY_DIRTY_BYTES;
+    Byte *base, *aligned;
+    size_t tail;
+
+    if (pages != MACHINE_PAGES_SMALL) {
+        length = (length + MACHINE_HUGE_PAGE - 1) &
+                 ~(size_t)(MACHINE_HUGE_PAGE - 1);
+    }
+    if (pages == MACHINE_PAGES_HUGETLB) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            *mapped = length;
+            return base;
+        }
+    }
+    // one huge page extra, so an aligned range can be cut out of it
+    tail = pages == MACHINE_PAGES_SMALL ? 0 : MACHINE_HUGE_PAGE;
+    base = mmap(NULL, length + tail, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = base;
+    if (tail) {
+        aligned = (Byte *)(((uintptr_t)base + MACHINE_HUGE_PAGE - 1) &
+                           ~(uintptr_t)(MACHINE_HUGE_PAGE - 1));
+        if (aligned > base) {
+            munmap(base, aligned - base);
+        }
+        if (base + tail > aligned) {
+            munmap(aligned + length, base + tail - aligned);
+        }
+        // only advice: without THP the pages are small and nothing fails
+        madvise(aligned, length, MADV_HUGEPAGE);
+    }
+    *mapped = length;
+    return aligned;
+}
+
+/* Binds a mapping that has not been touched yet to one node */
+static int bind_memory(Byte *memory, size_t length, int node) {
+    unsigned long mask[16] = {0};
+    size_t bits = sizeof(mask) * 8;
+
+    if (node < 0 || (size_t)node >= bits) {
+        return -1;
+    }
+    mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+    // the kernel reads maxnode - 1 bits of the mask
+    return syscall(SYS_mbind, memory, length, MPOL_BIND, mask, bits + 1, 0)
+               == 0 ? 0 : -1;
+}
+
+/* The devices every machine starts with */
+static void attach_devices(Machine *m) {
+    const MmioDevice devices[] = {
+        {CLINT_BASE, CLINT_SIZE, clint_load, clint_store, NULL},
+        {UART_BASE, UART_SIZE, uart_load, uart_store, NULL},
+        {CONSOLE_BASE, CONSOLE_SIZE, console_load, console_store, &m->console},
+    };
+    size_t i;
+
+    m->mmio.count = 0;
+    for (i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        mmio_attach(&m->mmio, &devices[i]);
+    }
+    m->processor.mmio = &m->mmio;
+}
+
+Machine *machine_create(int superblocks) {
+    return machine_create_placed(superblocks, MACHINE_PAGES_SMALL, -1);
+}
+
+Machine *machine_create_placed(int superblocks, MachinePages pages, int node) {
+    Machine *m = calloc(1, sizeof(Machine));
+
+    if (m == NULL) {
+        return NULL;
+    }
+    // mbind needs a page-aligned range nobody has touched, so not calloc
+    if (pages == MACHINE_PAGES_SMALL && node < 0) {
+        m->memory = calloc(MEMORY_SPACE + MEMORY_DIRTY_BYTES, sizeof(Byte));
+    } else {
+        m->memory = map_memory(pages, &m->mapped);
+        if (m->memory && node >= 0 &&
+            bind_memory(m->memory, m->mapped, node) != 0) {
+            machine_destroy(m);
+            return NULL;
+        }
+    }
+    if (superblocks) {
+        m->processor.sb = sb_create();
+    }
+    if (m->memory == NULL || (superblocks && m->processor.sb == NULL)) {
+        machine_destroy(m);
+        return NULL;
+    }
+    attach_devices(m);
+    machine_reset(m);
+    return m;
+}
+
+void machine_destroy(Machine *m) {
+    if (m) {
+        if (m->processor.sb) {
+            sb_destroy(m->processor.sb);
+        }
+        if (m->mapped) {
+            munmap(m->memory, m->mapped);
+        } else {
+            free(m->memory);
+        }
+        free(m);
+    }
+}
+
+int machine_bind_thread(int node) {
+    char path[64], list[4096], *p = list;
+    FILE *file;
+    cpu_set_t cpus;
+    long first, last;
+
+    if (node < 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    if (fgets(list, sizeof(list), file) == NULL) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    // e.g. "0-3,8-11"
+    CPU_ZERO(&cpus);
+    while (*p >= '0' && *p <= '9') {
+        first = last = strtol(p, &p, 10);
+        if (*p == '-') {
+            last = strtol(p + 1, &p, 10);
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, &cpus);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    if (CPU_COUNT(&cpus) == 0) {
+        return -1;
+    }
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? 0 : -1;
+}
+
+void machine_reset(Machine *m) {
+    Processor *p = &m->processor;
+
+    memset(p->R, 0, sizeof(p->R));
+    /* the middle of the static data segment, and near the top of memory */
+    p->R[3] = 0x3000;
+    p->R[2] = 0xEFFFF;
+    p->PC = MACHINE_ENTRY;
+    p->instret = 0;
+    p->status = MACHINE_RUNNING;
+    p->time_base = host_clock_ns();
+    memset(&p->V, 0, sizeof(p->V));
+    p->V.vtype = VTYPE_VILL;
+    memset(&p->trap, 0, sizeof(p->trap));
+    p->trap.mtimecmp = UINT64_MAX;
+    p->yield = 0;
+    memset(&m->console, 0, sizeof(m->console));
+    if (p->sb) {
+        sb_flush(p->sb);
+    }
+}
+
+void machine_clear_memory(Machine *m) {
+    Byte *bitmap = m->memory + MEMORY_SPACE;
+    Word i, bits, page;
+
+    for (i = 0; i < MEMORY_DIRTY_BYTES; i++) {
+        for (bits = bitmap[i]; bits; bits &= bits - 1) {
+            page = i * 8 + __builtin_ctz(bits);
+            memset(m->memory + (page << MEMORY_PAGE_SHIFT), 0, MEMORY_PAGE);
+        }
+        bitmap[i] = 0;
+    }
+    if (m->processor.sb) {
+        sb_flush(m->processor.sb);
+    }
+}
+
+struct MachinePool {
+    int superblocks;
+    MachinePages pages;
+    int node;
+    size_t keep;
+    size_t idle;
+    Machine **machines;
+};
+
+MachinePool *machine_pool_create(int superblocks, MachinePages pages, int node,
+                                 size_t keep) {
+    MachinePool *pool = calloc(1, sizeof(MachinePool));
+
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->machines = calloc(keep ? keep : 1, sizeof(Machine *));
+    if (pool->machines == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->superblocks = superblocks;
+    pool->pages = pages;
+    pool->node = node;
+    pool->keep = keep;
+    return pool;
+}
+
+void machine_pool_destroy(MachinePool *pool) {
+    if (pool) {
+        while (pool->idle > 0) {
+            machine_destroy(pool->machines[--pool->idle]);
+        }
+        free(pool->machines);
+        free(pool);
+    }
+}
+
+Machine *machine_pool_acquire(MachinePool *pool) {
+    if (pool->idle > 0) {
+        return pool->machines[--pool->idle];
+    }
+    return machine_create_placed(pool->superblocks, pool->pages, pool->node);
+}
+
+void machine_pool_release(MachinePool *pool, Machine *m) {
+    Processor *p = &m->processor;
+
+    if (pool->idle == pool->keep) {
+        machine_destroy(m);
+        return;
+    }
+    machine_clear_memory(m);
+    machine_reset(m);
+    // hooks belong to whoever ran the machine
+    p->bpred = NULL;
+    p->memtrace = NULL;
+    p->replay = NULL;
+    attach_devices(m);
+    m->program_length = 0;
+    pool->machines[pool->idle++] = m;
+}
+
+int machine_load_program(Machine *m, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[MAX_LINE];
+    Address address = MACHINE_ENTRY;
+    int count = 0;
+
+    if (file == NULL) {
+        return -1;
+    }
+    while (fgets(line, MAX_LINE, file) != NULL) {
+        if (address > MEMORY_SPACE - 4) {
+            fclose(file);
+            return -1;
+        }
+        store(m->memory, address, LENGTH_WORD, (Word)strtol(line, NULL, 16));
+        address += 4;
+        count++;
+    }
+    fclose(file);
+    if (m->processor.sb) {
+        sb_flush(m->processor.sb);
+    }
+    m->program_length = count;
+    return count;
+}
+
+int machine_load_words(Machine *m, const Word *words, size_t count) {
+    size_t i;
+
+    if (count > (MEMORY_SPACE - MACHINE_ENTRY) / 4) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        store(m->memory, MACHINE_ENTRY + i * 4, LENGTH_WORD, words[i]);
+    }
+    if (m->processor.sb) {
+        sb_flush(m->processor.sb);
+    }
+    m->program_length = count;
+    return count;
+}
+
+/* Runs until the budget runs out, the machine halts or something sets
+   yield */
+static Double run_slice(Machine *m, Double budget, InstructionHook hook) {
+    Processor *p = &m->processor;
+    Double n = 0;
+
+    if (p->sb) {
+        return sb_run(p->sb, p, m->memory, budget, hook);
+    }
+    while (n < budget) {
+        Word bits;
+
+        if (!fetch(p, m->memory, &bits)) {
+            break;
+        }
+        execute_instruction(bits, p, m->memory);
+        p->R[0] = 0;
+        if (p->status) {
+            break;
+        }
+        p->instret++;
+        if (hook) {
+            hook(p);
+        }
+        n++;
+        if (p->yield) {
+            break;
+        }
+    }
+    return n;
+}
+
+int machine_attach(Machine *m, const MmioDevice *device) {
+    return mmio_attach(&m->mmio, device);
+}
+
+MachineStatus machine_run(Machine *m, Double budget, InstructionHook hook,
+                          Double *executed) {
+    Processor *p = &m->processor;
+    Double n = 0, slice;
+
+    // slices end where an interrupt may become due, and it is taken there
+    while (p->status == MACHINE_RUNNING && n < budget) {
+        trap_poll(p);
+        slice = trap_horizon(p);
+        if (slice > budget - n) {
+            slice = budget - n;
+        }
+        n += run_slice(m, slice, hook);
+    }
+    if (executed) {
+        *executed = n;
+    }
+    return p->status;
+}
+
+MachineStatus machine_step(Machine *m) {
+    return machine_run(m, 1, NULL, NULL);
+}
+
+Register machine_get_register(const Machine *m, int index) {
+    return index > 0 && index < 32 ? m->processor.R[index] : 0;
+}
+
+void machine_set_register(Machine *m, int index, Register value) {
+    if (index > 0 && index < 32) {
+        m->processor.R[index] = value;
+    }
+}
+
+int machine_read(const Machine *m, Address address, void *out, size_t length) {
+    if (!in_memory(address, length)) {
+        return -1;
+    }
+    memcpy(out, m->memory + address, length);
+    return 0;
+}
+
+int machine_write(Machine *m, Address address, const void *in, size_t length) {
+    if (!in_memory(address, length)) {
+        return -1;
+    }
+    memcpy(m->memory + address, in, length);
+    memory_dirty(m->memory, address, length);
+    // the write may cover code that superblocks were formed from
+    sb_check_range(m->processor.sb, address, length);
+    return 0;
+}
+
+void machine_code_changed(Machine *m) {
+    if (m->processor.sb) {
+        sb_flush(m->processor.sb);
+    }
+}
+
+const char *machine_status_string(MachineStatus status) {
+    switch (status) {
+        case MACHINE_RUNNING: return "running";
+        case MACHINE_EXITED: return "exited";
+        case MACHINE_INVALID_INSTRUCTION: return "invalid instruction";
+        case MACHINE_UNKNOWN_OPCODE: return "unknown opcode";
+        case MACHINE_ILLEGAL_ECALL: return "illegal ecall";
+        case MACHINE_ACCESS_FAULT: return "access fault";
+    }
+    return "unknown status";
+}
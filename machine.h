@@ -0,0 +1,124 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stddef.h>
+#include "types.h"
+#include "mmio.h"
+#include "superblock.h"
+
+/* libriscvemu: an emulated machine as a self-contained object. A Machine
+   owns its memory, its Processor and its superblock cache, and no library
+   code keeps global state (the listings format on the caller's stack), so
+   one process can host any number of machines. Nothing here ends the
+   process: the ecall exit and every error, including an access outside
+   guest memory that no device takes, halt the machine with a status
+   instead. Guest output (ecalls 1, 4 and 11, the uart
+   and the console) and the "Invalid Instruction" messages still go to
+   stdout. */
+
+typedef enum {
+    MACHINE_RUNNING = 0,         /* the instruction budget ran out */
+    MACHINE_EXITED,              /* ecall 10 */
+    MACHINE_INVALID_INSTRUCTION, /* a known opcode with bad function bits */
+    MACHINE_UNKNOWN_OPCODE,      /* an opcode outside the decode table */
+    MACHINE_ILLEGAL_ECALL,       /* an ecall number other than 1, 4, 10-16 */
+    MACHINE_ACCESS_FAULT,        /* an access outside memory no device took */
+} MachineStatus;
+
+typedef struct Machine {
+    Processor processor;
+    Byte *memory; /* MEMORY_SPACE bytes, then the dirty page bitmap */
+    size_t mapped; /* bytes mapped for memory, 0 if it came from calloc */
+    int program_length; /* instructions loaded by machine_load_program() */
+    MmioBus mmio; /* the clint, uart and console, then attached devices */
+    Console console;
+} Machine;
+
+/* What backs guest memory. Huge pages cover all of it with one host TLB
+   entry instead of 256, at the price of a whole 2 MiB page per machine
+   (memory is 1 MiB). */
+typedef enum {
+    MACHINE_PAGES_SMALL,       /* calloc, as machine_create() does */
+    MACHINE_PAGES_TRANSPARENT, /* an aligned mapping advised MADV_HUGEPAGE */
+    MACHINE_PAGES_HUGETLB,     /* the MAP_HUGETLB pool, else transparent */
+} MachinePages;
+
+#define MACHINE_HUGE_PAGE (2 * 1024 * 1024)
+
+#define MACHINE_ENTRY 0x1000
+
+/* Returns NULL if out of memory. With superblocks 0 every instruction is
+   interpreted on its own, e.g. to single-step through the reference path. */
+Machine *machine_create(int superblocks);
+
+/* As machine_create(), with memory backed by pages and bound to NUMA node
+   node. With node -1 memory is placed on first touch, i.e. on the node of
+   the thread that loads the program, so a batch runner pins each worker
+   with machine_bind_thread() before creating its machines. Returns NULL
+   if out of memory or if the node cannot be bound to. */
+Machine *machine_create_placed(int superblocks, MachinePages pages, int node);
+
+/* Pins the calling thread to the CPUs of NUMA node node; returns -1 if
+   there is no such node or the affinity cannot be set */
+int machine_bind_thread(int node);
+void machine_destroy(Machine *);
+
+/* Adds a device to the machine's bus; returns -1 as mmio_attach() does.
+   The context must outlive the machine, or its return to a pool. */
+int machine_attach(Machine *, const MmioDevice *);
+
+/* Zeroes the registers except gp (0x3000) and sp (0xEFFFF), sets the PC to
+   MACHINE_ENTRY and clears the status; vector registers are zeroed with vl
+   0 and vill set, and so are the trap state and console registers. Memory
+   and attached devices are left alone. */
+void machine_reset(Machine *);
+
+/* Zeroes the memory pages written since the last clear (or since the
+   machine was created) and drops superblocks formed from them. Cheaper
+   than clearing all of memory when runs are short. */
+void machine_clear_memory(Machine *);
+
+/* A pool of machines recycled between runs, so that many short runs pay
+   neither for allocating memory and the superblock cache nor for zeroing
+   all of memory. A released machine has its dirty pages cleared, is reset
+   and loses its bpred, memtrace and replay hooks and the devices attached
+   with machine_attach(); up to keep of them wait to be acquired again, and
+   the rest are destroyed. Acquiring from an empty pool creates a machine
+   with the pool's settings. A pool is not thread safe: give each worker its
+   own. */
+typedef struct MachinePool MachinePool;
+
+MachinePool *machine_pool_create(int superblocks, MachinePages pages, int node,
+                                 size_t keep);
+void machine_pool_destroy(MachinePool *);
+Machine *machine_pool_acquire(MachinePool *);
+void machine_pool_release(MachinePool *, Machine *);
+
+/* Loads a program of one hex word per line at MACHINE_ENTRY. Returns the
+   number of instructions, or -1 if the file cannot be read or does not fit. */
+int machine_load_program(Machine *, const char *path);
+int machine_load_words(Machine *, const Word *words, size_t count);
+
+/* Runs up to budget instructions, calling hook (if not NULL) after each one
+   retired. Returns MACHINE_RUNNING if the budget ran out and the halt status
+   otherwise; a halted machine runs again only after machine_reset(). If
+   executed is not NULL it receives the number of instructions retired. */
+MachineStatus machine_run(Machine *, Double budget, InstructionHook hook,
+                          Double *executed);
+MachineStatus machine_step(Machine *);
+
+Register machine_get_register(const Machine *, int index);
+void machine_set_register(Machine *, int index, Register value);
+
+/* Copy between guest memory and a host buffer. Return -1, copying nothing,
+   if the range is not entirely inside guest memory. */
+int machine_read(const Machine *, Address address, void *out, size_t length);
+int machine_write(Machine *, Address address, const void *in, size_t length);
+
+/* Drops the superblocks formed so far, for callers that write guest memory
+   other than through machine_write(), such as through m->memory itself */
+void machine_code_changed(Machine *);
+
+const char *machine_status_string(MachineStatus);
+
+#endif
@@ -0,0 +1,134 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "memtrace.h"
+#include "ring.h"
+
+#define RING_RECORDS (1U << 16)
+#define BATCH_RECORDS 4096
+/* worst case per record: flags byte plus two 5-byte varints */
+#define MAX_ENCODED 11
+
+typedef struct {
+    Address pc;
+    Address address;
+    Word flags;
+} Access;
+
+struct MemTrace {
+    Ring ring;
+    Word period;
+    Word burst;
+    Word phase;
+    FILE *file;
+    pthread_t writer;
+    atomic_int stop;
+    /* writer thread scratch */
+    Access batch[BATCH_RECORDS];
+    Byte encoded[BATCH_RECORDS * MAX_ENCODED];
+};
+
+static inline Byte *put_varint(Byte *out, Word value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static inline Word zigzag(sWord value) {
+    return ((Word)value << 1) ^ (Word)(value >> 31);
+}
+
+static void *writer_main(void *arg) {
+    MemTrace *t = arg;
+    Access *batch = t->batch;
+    Byte *out = t->encoded;
+    Address prev_address = 0, prev_pc = 0;
+    struct timespec idle = {0, 100000};
+
+    for (;;) {
+        size_t i, n = ring_pop(&t->ring, batch, BATCH_RECORDS);
+        Byte *p = out;
+
+        if (n == 0) {
+            if (atomic_load(&t->stop) && ring_count(&t->ring) == 0) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            *p++ = batch[i].flags;
+            p = put_varint(p, zigzag((sWord)(batch[i].address - prev_address)));
+            p = put_varint(p, zigzag((sWord)(batch[i].pc - prev_pc)));
+            prev_address = batch[i].address;
+            prev_pc = batch[i].pc;
+        }
+        fwrite(out, 1, p - out, t->file);
+    }
+    return NULL;
+}
+
+static void put_word(Byte *out, Word value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+MemTrace *memtrace_open(const char *path, Word period, Word burst) {
+    MemTrace *t = calloc(1, sizeof(MemTrace));
+    Byte header[16] = {'R', 'V', 'M', 'T', MEMTRACE_VERSION};
+
+    if (t == NULL) {
+        return NULL;
+    }
+    if (period == 0) {
+        period = 1;
+    }
+    t->period = period;
+    t->burst = burst == 0 || burst > period ? period : burst;
+    t->file = fopen(path, "wb");
+    if (t->file == NULL) {
+        free(t);
+        return NULL;
+    }
+    put_word(header + 8, t->period);
+    put_word(header + 12, t->burst);
+    fwrite(header, 1, sizeof(header), t->file);
+
+    atomic_init(&t->stop, 0);
+    if (ring_init(&t->ring, sizeof(Access), RING_RECORDS) != 0 ||
+        pthread_create(&t->writer, NULL, writer_main, t) != 0) {
+        ring_free(&t->ring);
+        fclose(t->file);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void memtrace_close(MemTrace *t) {
+    atomic_store(&t->stop, 1);
+    pthread_join(t->writer, NULL);
+    fclose(t->file);
+    ring_free(&t->ring);
+    free(t);
+}
+
+void memtrace_record(MemTrace *t, Address pc, Address address,
+                     Alignment alignment, int is_write) {
+    int sampled = t->phase < t->burst;
+
+    if (++t->phase == t->period) {
+        t->phase = 0;
+    }
+    if (sampled) {
+        Access a = {pc, address, alignment | (is_write ? MEMTRACE_WRITE : 0)};
+        // never drop: sampling is what bounds the overhead
+        ring_push_wait(&t->ring, &a);
+    }
+}
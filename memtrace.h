@@ -0,0 +1,41 @@
+#ifndef MEMTRACE_H
+#define MEMTRACE_H
+
+#include "types.h"
+
+/* Guest memory access trace (-m). Accesses are queued on a lock-free ring
+   and encoded by a writer thread, so the emulator only pays for a sampling
+   check and a 12-byte copy per recorded access.
+
+   File format, little endian:
+     header  "RVMT" u8 version u8 reserved[3] u32 period u32 burst
+     record  u8 flags, varint zigzag(addr - prev_addr),
+             varint zigzag(pc - prev_pc)
+   flags bits 0-2 hold the access size in bytes (1, 2 or 4) and bit 3 is
+   set for writes. prev_addr and prev_pc start at 0. varints are LEB128.
+   Of every period accesses, the first burst are recorded. */
+
+#define MEMTRACE_VERSION 1
+#define MEMTRACE_WRITE 0x8
+
+typedef struct MemTrace MemTrace;
+
+/* Returns NULL if the file cannot be opened or the writer cannot start */
+MemTrace *memtrace_open(const char *path, Word period, Word burst);
+
+/* Drains the ring, stops the writer and closes the file */
+void memtrace_close(MemTrace *);
+
+void memtrace_record(MemTrace *, Address pc, Address address,
+                     Alignment alignment, int is_write);
+
+/* Hook for load/store handlers: a no-op unless tracing is on */
+static inline void memtrace_access(Processor *processor, Address address,
+                                   Alignment alignment, int is_write) {
+    if (processor->memtrace) {
+        memtrace_record(processor->memtrace, processor->PC, address, alignment,
+                        is_write);
+    }
+}
+
+#endif
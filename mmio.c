@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include "mmio.h"
+#include "riscv.h"
+
+int mmio_attach(MmioBus *bus, const MmioDevice *device) {
+    Address end = device->base + device->size;
+    int i;
+
+    if (bus->count == MMIO_DEVICES || device->size == 0 ||
+        end < device->base || device->base < MEMORY_SPACE) {
+        return -1;
+    }
+    for (i = 0; i < bus->count; i++) {
+        const MmioDevice *other = &bus->device[i];
+
+        if (device->base < other->base + other->size && other->base < end) {
+            return -1;
+        }
+    }
+    bus->device[bus->count++] = *device;
+    return 0;
+}
+
+static const MmioDevice *find(const Processor *p, Address address,
+                              Alignment length) {
+    int i;
+
+    if (p->mmio == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < p->mmio->count; i++) {
+        const MmioDevice *device = &p->mmio->device[i];
+
+        if (address - device->base < device->size &&
+            length <= device->size - (address - device->base)) {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+int mmio_load(Processor *p, Byte *memory, Address address, Alignment length,
+              Double instret, Word *value) {
+    const MmioDevice *device = find(p, address, length);
+
+    return device && device->load &&
+           device->load(device->context, p, memory, address - device->base,
+                        length, instret, value);
+}
+
+int mmio_store(Processor *p, Byte *memory, Address address, Alignment length,
+               Double instret, Word value) {
+    const MmioDevice *device = find(p, address, length);
+
+    return device && device->store &&
+           device->store(device->context, p, memory, address - device->base,
+                         length, instret, value);
+}
+
+int uart_load(void *context, Processor *p, Byte *memory, Word offset,
+              Alignment length, Double instret, Word *value) {
+    if (length != LENGTH_BYTE) {
+        return 0;
+    }
+    // nothing is ever received, and the transmitter never backs up
+    *value = offset == UART_LSR ? UART_LSR_THRE | UART_LSR_TEMT : 0;
+    return 1;
+}
+
+int uart_store(void *context, Processor *p, Byte *memory, Word offset,
+               Alignment length, Double instret, Word value) {
+    if (length != LENGTH_BYTE) {
+        return 0;
+    }
+    // writes to the control registers are accepted and change nothing
+    if (offset == UART_THR) {
+        putchar(value & 0xFF);
+    }
+    return 1;
+}
+
+int console_load(void *context, Processor *p, Byte *memory, Word offset,
+                 Alignment length, Double instret, Word *value) {
+    const Console *console = context;
+
+    if (length != LENGTH_WORD) {
+        return 0;
+    }
+    switch (offset) {
+        case CONSOLE_ADDRESS: *value = console->address; break;
+        case CONSOLE_LENGTH: *value = console->length; break;
+        case CONSOLE_NOTIFY: *value = 0; break;
+        default: return 0;
+    }
+    return 1;
+}
+
+int console_store(void *context, Processor *p, Byte *memory, Word offset,
+                  Alignment length, Double instret, Word value) {
+    Console *console = context;
+
+    if (length != LENGTH_WORD) {
+        return 0;
+    }
+    switch (offset) {
+        case CONSOLE_ADDRESS: console->address = value; break;
+        case CONSOLE_LENGTH: console->length = value; break;
+        case CONSOLE_NOTIFY:
+            if (!in_memory(console->address, console->length)) {
+                return 0;
+            }
+            fwrite(memory + console->address, 1, console->length, stdout);
+            break;
+        default: return 0;
+    }
+    return 1;
+}
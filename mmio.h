@@ -0,0 +1,105 @@
+#ifndef MMIO_H
+#define MMIO_H
+
+#include "types.h"
+
+/* Memory-mapped devices. Guest memory is RAM from 0 to MEMORY_SPACE, and
+   a scalar load or store anywhere above it goes to the device whose range
+   holds it, or halts the machine with MACHINE_ACCESS_FAULT if none does or
+   the device rejects the access. The only test on the RAM fast path is
+   mmio_outside(), one compare against a constant; everything behind it
+   runs from the fallback path, one instruction at a time. Vector accesses
+   and the bulk ecalls stay RAM only.
+
+   A bus is a short table searched in order, and each Machine has its own
+   (machine.h) with these devices attached:
+     clint    CLINT_BASE   timer and software interrupts (trap.h)
+     uart     UART_BASE    the transmit side of a 16550: each byte written
+                           to THR goes to stdout
+     console  CONSOLE_BASE bulk output: write a guest buffer's address and
+                           length, then anything to NOTIFY, and the buffer
+                           goes to stdout in one write
+   and optionally
+     block    BLOCK_BASE   sectors of a mapped host file (block.h)
+   Devices see offsets from their base, lengths that do not straddle the
+   end of their range, and instret as of the access (trap.h). A device that
+   raises an interrupt or otherwise needs the run loop to look again sets
+   Processor.yield. */
+
+typedef int (*MmioLoad)(void *context, Processor *, Byte *memory,
+                        Word offset, Alignment, Double instret, Word *value);
+typedef int (*MmioStore)(void *context, Processor *, Byte *memory,
+                         Word offset, Alignment, Double instret, Word value);
+
+/* Either callback may be NULL, making the range write- or read-only. Both
+   return 0 to reject the access. Loads of bytes and halves return the
+   value sign-extended, as load() does. */
+typedef struct {
+    Address base;
+    Word size;
+    MmioLoad load;
+    MmioStore store;
+    void *context;
+} MmioDevice;
+
+#define MMIO_DEVICES 8
+
+typedef struct MmioBus {
+    int count;
+    MmioDevice device[MMIO_DEVICES];
+} MmioBus;
+
+/* Is an access of length bytes at address outside guest memory? */
+static inline int mmio_outside(Address address, Alignment length) {
+    return address > MEMORY_SPACE - length;
+}
+
+/* Returns -1 if the bus is full or the range is empty, wraps, overlaps
+   guest memory or overlaps another device */
+int mmio_attach(MmioBus *, const MmioDevice *);
+
+/* Return 0 if no device takes the access */
+int mmio_load(Processor *, Byte *memory, Address, Alignment, Double instret,
+              Word *value);
+int mmio_store(Processor *, Byte *memory, Address, Alignment, Double instret,
+               Word value);
+
+/* Sign-extends a device register read the way load() does */
+static inline Word mmio_extend(Word value, Alignment length) {
+    return length == LENGTH_BYTE ? (Word)(sByte)value
+         : length == LENGTH_HALF_WORD ? (Word)(sHalf)value : value;
+}
+
+/* 16550 registers; only byte accesses are accepted */
+#define UART_BASE 0x10000000
+#define UART_SIZE 0x8
+#define UART_THR 0 /* transmit holding on write, receive buffer on read */
+#define UART_LSR 5
+#define UART_LSR_THRE 0x20 /* room to transmit, which there always is */
+#define UART_LSR_TEMT 0x40
+
+int uart_load(void *, Processor *, Byte *, Word offset, Alignment,
+              Double instret, Word *value);
+int uart_store(void *, Processor *, Byte *, Word offset, Alignment,
+               Double instret, Word value);
+
+/* Console registers, words only. A notify whose buffer is not inside guest
+   memory is rejected without writing anything. */
+#define CONSOLE_BASE 0x10001000
+#define CONSOLE_SIZE 0xC
+#define CONSOLE_ADDRESS 0x0
+#define CONSOLE_LENGTH 0x4
+#define CONSOLE_NOTIFY 0x8
+
+typedef struct {
+    Address address;
+    Word length;
+} Console;
+
+/* context is a Console */
+int console_load(void *, Processor *, Byte *, Word offset, Alignment,
+                 Double instret, Word *value);
+int console_store(void *, Processor *, Byte *, Word offset, Alignment,
+                  Double instret, Word value);
+
+#endif
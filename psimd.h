@@ -0,0 +1,130 @@
+#ifndef PSIMD_H
+#define PSIMD_H
+
+#include "types.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Packed-SIMD custom instructions: opcode 0x2b, funct3 3, R-type operands,
+   funct7 selects the operation. Registers hold four 8-bit (b) or two
+   16-bit (h) lanes, lane 0 in the low bits. Lanes are signed; add, sub and
+   mac wrap, kadd saturates. mac and dot also read rd:
+     mac  rd.lane += rs1.lane * rs2.lane
+     dot  rd += sum of rs1.lane * rs2.lane (32-bit, wrapping)
+   Each op maps onto a few SSE2 instructions on a 32-bit slice of an XMM
+   register; other hosts use the scalar lane loops. */
+
+#define PSIMD_FUNCT3 0x3
+
+enum {
+    PSIMD_ADD8 = 0x00,
+    PSIMD_ADD16,
+    PSIMD_SUB8,
+    PSIMD_SUB16,
+    PSIMD_KADD8,
+    PSIMD_KADD16,
+    PSIMD_MAC8,
+    PSIMD_MAC16,
+    PSIMD_DOT8,
+    PSIMD_DOT16,
+    PSIMD_MIN8,
+    PSIMD_MIN16,
+    PSIMD_MAX8,
+    PSIMD_MAX16,
+    PSIMD_COUNT
+};
+
+/* Does this funct7 read rd as well? */
+#define PSIMD_READS_RD(funct7) ((funct7) >= PSIMD_MAC8 && (funct7) <= PSIMD_DOT16)
+
+#ifdef __SSE2__
+
+#define LANES(w) _mm_cvtsi32_si128((int)(w))
+#define WORD(v) ((Word)_mm_cvtsi128_si32(v))
+
+/* 8-bit lanes widened to 16 bits, sign-extended */
+static inline __m128i psimd_widen8(__m128i v) {
+    return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+/* signed 8-bit min/max through the unsigned forms SSE2 has */
+static inline __m128i psimd_min8(__m128i a, __m128i b) {
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    return _mm_xor_si128(_mm_min_epu8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias)), bias);
+}
+
+static inline __m128i psimd_max8(__m128i a, __m128i b) {
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    return _mm_xor_si128(_mm_max_epu8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias)), bias);
+}
+
+static inline Word psimd_execute(Word funct7, Word d, Word a, Word b) {
+    __m128i va = LANES(a), vb = LANES(b), vd = LANES(d), t;
+
+    switch (funct7) {
+        case PSIMD_ADD8: return WORD(_mm_add_epi8(va, vb));
+        case PSIMD_ADD16: return WORD(_mm_add_epi16(va, vb));
+        case PSIMD_SUB8: return WORD(_mm_sub_epi8(va, vb));
+        case PSIMD_SUB16: return WORD(_mm_sub_epi16(va, vb));
+        case PSIMD_KADD8: return WORD(_mm_adds_epi8(va, vb));
+        case PSIMD_KADD16: return WORD(_mm_adds_epi16(va, vb));
+        case PSIMD_MAC8:
+            // low bytes of the 16-bit products are the wrapped 8-bit ones
+            t = _mm_mullo_epi16(psimd_widen8(va), psimd_widen8(vb));
+            t = _mm_and_si128(t, _mm_set1_epi16(0xFF));
+            return WORD(_mm_add_epi8(vd, _mm_packus_epi16(t, t)));
+        case PSIMD_MAC16:
+            return WORD(_mm_add_epi16(vd, _mm_mullo_epi16(va, vb)));
+        case PSIMD_DOT8:
+            // two pairwise sums of products, then the two halves
+            t = _mm_madd_epi16(psimd_widen8(va), psimd_widen8(vb));
+            return d + WORD(t) + WORD(_mm_srli_si128(t, 4));
+        case PSIMD_DOT16:
+            return d + WORD(_mm_madd_epi16(va, vb));
+        case PSIMD_MIN8: return WORD(psimd_min8(va, vb));
+        case PSIMD_MIN16: return WORD(_mm_min_epi16(va, vb));
+        case PSIMD_MAX8: return WORD(psimd_max8(va, vb));
+        case PSIMD_MAX16: return WORD(_mm_max_epi16(va, vb));
+    }
+    return 0;
+}
+
+#undef LANES
+#undef WORD
+
+#else
+
+static inline Word psimd_execute(Word funct7, Word d, Word a, Word b) {
+    int width = (funct7 & 1) ? 16 : 8;
+    Word mask = (width == 16) ? 0xFFFF : 0xFF;
+    sWord dot = 0;
+    Word result = 0;
+    int shift;
+
+    for (shift = 0; shift < 32; shift += width) {
+        sWord x = (sWord)(a << (32 - width - shift)) >> (32 - width);
+        sWord y = (sWord)(b << (32 - width - shift)) >> (32 - width);
+        sWord z = (sWord)(d << (32 - width - shift)) >> (32 - width);
+        sWord lane, limit = (width == 16) ? 0x7FFF : 0x7F;
+
+        switch (funct7) {
+            case PSIMD_ADD8: case PSIMD_ADD16: lane = x + y; break;
+            case PSIMD_SUB8: case PSIMD_SUB16: lane = x - y; break;
+            case PSIMD_KADD8: case PSIMD_KADD16:
+                lane = x + y;
+                lane = lane > limit ? limit : lane < -limit - 1 ? -limit - 1 : lane;
+                break;
+            case PSIMD_MAC8: case PSIMD_MAC16: lane = z + x * y; break;
+            case PSIMD_DOT8: case PSIMD_DOT16: dot += x * y; lane = 0; break;
+            case PSIMD_MIN8: case PSIMD_MIN16: lane = x < y ? x : y; break;
+            default: lane = x > y ? x : y; break;
+        }
+        result |= ((Word)lane & mask) << shift;
+    }
+    return (funct7 == PSIMD_DOT8 || funct7 == PSIMD_DOT16) ? d + dot : result;
+}
+
+#endif
+
+#endif
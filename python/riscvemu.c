@@ -0,0 +1,572 @@
+/* Python bindings for libriscvemu (machine.h).
+
+   riscvemu.Machine wraps one emulated machine. Guest memory is exported
+   through the buffer protocol: machine.memory and
+   numpy.frombuffer(machine, numpy.uint8) read and write it in place, while
+   memoryview(machine), which asks for no write access, is read-only.
+   machine.registers is a writable uint32 view of x0..x31 that aliases the
+   register file the same way. Nothing is copied per instruction or per
+   call, so a script can run many programs in one interpreter:
+
+       m = riscvemu.Machine()
+       m.load("code/input/multiply.input")
+       status = m.run(10000)
+       m.registers[9], m.memory[0x1000:0x1004], m.pc */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "block.h"
+#include "machine.h"
+#include "riscv.h"
+
+typedef struct {
+    PyObject_HEAD
+    Machine *machine;
+    MachinePool *pool; /* where machine goes back to, if anywhere */
+    Block *disk; /* attached with attach_disk(), NULL if none */
+    Py_ssize_t exports; /* live buffers; memory must outlive them */
+    Py_ssize_t writers; /* live writable memory exports */
+    int code_stale; /* memory may have been written since the last run */
+} MachineObject;
+
+/* Machines with default placement are recycled, with and without
+   superblocks, so creating one per run costs no allocation or zeroing */
+#define POOL_KEEP 64
+static MachinePool *pools[2];
+
+/* Exporter of the register file; holds a reference to its machine */
+typedef struct {
+    PyObject_HEAD
+    MachineObject *owner;
+} RegistersObject;
+
+static PyTypeObject RegistersType;
+
+/* Exporter of guest memory for machine.memory, always writable */
+typedef struct {
+    PyObject_HEAD
+    MachineObject *owner;
+} MemoryObject;
+
+static PyTypeObject MemoryType;
+
+static Py_ssize_t memory_shape[1] = {MEMORY_SPACE};
+static Py_ssize_t register_shape[1] = {32};
+static Py_ssize_t byte_stride[1] = {1};
+static Py_ssize_t word_stride[1] = {sizeof(Register)};
+
+static int check_running(MachineObject *self) {
+    if (self->machine == NULL) {
+        PyErr_SetString(PyExc_ValueError, "machine is closed");
+        return -1;
+    }
+    return 0;
+}
+
+static int Machine_init(MachineObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"superblocks", "pages", "node", NULL};
+    int superblocks = 1, node = -1;
+    const char *pages = "small";
+    MachinePages backing;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|psi", kwlist, &superblocks,
+                                     &pages, &node)) {
+        return -1;
+    }
+    if (strcmp(pages, "small") == 0) {
+        backing = MACHINE_PAGES_SMALL;
+    } else if (strcmp(pages, "thp") == 0) {
+        backing = MACHINE_PAGES_TRANSPARENT;
+    } else if (strcmp(pages, "hugetlb") == 0) {
+        backing = MACHINE_PAGES_HUGETLB;
+    } else {
+        PyErr_Format(PyExc_ValueError,
+                     "unknown pages %s (expected small, thp or hugetlb)", pages);
+        return -1;
+    }
+    if (self->machine) {
+        PyErr_SetString(PyExc_RuntimeError, "machine already initialized");
+        return -1;
+    }
+    if (backing == MACHINE_PAGES_SMALL && node < 0) {
+        if (pools[superblocks] == NULL) {
+            pools[superblocks] = machine_pool_create(
+                superblocks, MACHINE_PAGES_SMALL, -1, POOL_KEEP);
+        }
+        self->pool = pools[superblocks];
+    }
+    self->machine = self->pool ? machine_pool_acquire(self->pool)
+                               : machine_create_placed(superblocks, backing, node);
+    if (self->machine == NULL) {
+        if (node >= 0) {
+            PyErr_Format(PyExc_OSError, "cannot place memory on NUMA node %d",
+                         node);
+        } else {
+            PyErr_NoMemory();
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static void free_machine(MachineObject *self) {
+    if (self->machine && self->pool) {
+        machine_pool_release(self->pool, self->machine);
+    } else {
+        machine_destroy(self->machine);
+    }
+    self->machine = NULL;
+    /* the machine no longer has it on its bus */
+    block_close(self->disk);
+    self->disk = NULL;
+}
+
+static void Machine_dealloc(MachineObject *self) {
+    free_machine(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* Fills view with guest memory for exporter, which holds a reference to
+   self. Writes through a writable view bypass the dirty page bitmap and
+   the superblock cache, so only those mark every page dirty and have the
+   next run drop its superblocks (sync_code); read-only views leave both
+   alone. */
+static int export_memory(MachineObject *self, PyObject *exporter,
+                         Py_buffer *view, int flags) {
+    if (check_running(self) < 0) {
+        view->obj = NULL;
+        return -1;
+    }
+    if (flags & PyBUF_WRITABLE) {
+        memset(self->machine->memory + MEMORY_SPACE, 0xFF, MEMORY_DIRTY_BYTES);
+        self->writers++;
+        self->code_stale = 1;
+    }
+    view->buf = self->machine->memory;
+    view->obj = exporter;
+    view->len = MEMORY_SPACE;
+    view->readonly = !(flags & PyBUF_WRITABLE);
+    view->itemsize = 1;
+    view->format = (flags & PyBUF_FORMAT) ? "B" : NULL;
+    view->ndim = 1;
+    view->shape = memory_shape;
+    view->strides = byte_stride;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    Py_INCREF(exporter);
+    self->exports++;
+    return 0;
+}
+
+static int Machine_getbuffer(MachineObject *self, Py_buffer *view, int flags) {
+    return export_memory(self, (PyObject *)self, view, flags);
+}
+
+static void Machine_releasebuffer(MachineObject *self, Py_buffer *view) {
+    self->exports--;
+    self->writers -= !view->readonly;
+}
+
+/* Before running: guest code may have been patched through a writable
+   export, so superblocks formed from the old code go. While one is still
+   live it may be written again before any run, so every run flushes. */
+static void sync_code(MachineObject *self) {
+    if (self->code_stale) {
+        machine_code_changed(self->machine);
+        self->code_stale = self->writers > 0;
+    }
+}
+
+static PyObject *Machine_load(MachineObject *self, PyObject *args) {
+    PyObject *source;
+    int count;
+
+    if (check_running(self) < 0 || !PyArg_ParseTuple(args, "O", &source)) {
+        return NULL;
+    }
+    /* a fresh machine, so nothing of the previous program survives */
+    machine_reset(self->machine);
+    machine_clear_memory(self->machine);
+    if (PyUnicode_Check(source) || PyObject_HasAttrString(source, "__fspath__")) {
+        PyObject *path;
+        if (!PyUnicode_FSConverter(source, &path)) {
+            return NULL;
+        }
+        count = machine_load_program(self->machine, PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        if (count < 0) {
+            PyErr_Format(PyExc_OSError, "cannot load %R", source);
+            return NULL;
+        }
+    } else {
+        /* anything exporting little-endian instruction words, e.g. bytes
+           or array('I') */
+        Py_buffer words;
+        if (PyObject_GetBuffer(source, &words, PyBUF_SIMPLE) < 0) {
+            return NULL;
+        }
+        count = words.len % 4 ? -1
+              : machine_load_words(self->machine, words.buf, words.len / 4);
+        PyBuffer_Release(&words);
+        if (count < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "program must be whole words and fit in memory");
+            return NULL;
+        }
+    }
+    return PyLong_FromLong(count);
+}
+
+static PyObject *Machine_reset(MachineObject *self, PyObject *unused) {
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    machine_reset(self->machine);
+    Py_RETURN_NONE;
+}
+
+static PyObject *Machine_run(MachineObject *self, PyObject *args) {
+    unsigned long long budget = UINT64_MAX;
+    MachineStatus status;
+
+    if (check_running(self) < 0 || !PyArg_ParseTuple(args, "|K", &budget)) {
+        return NULL;
+    }
+    sync_code(self);
+    /* guest output goes through C stdio; keep it ordered with print() */
+    status = machine_run(self->machine, budget, NULL, NULL);
+    fflush(stdout);
+    return PyLong_FromLong(status);
+}
+
+static PyObject *Machine_step(MachineObject *self, PyObject *unused) {
+    MachineStatus status;
+
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    sync_code(self);
+    status = machine_step(self->machine);
+    fflush(stdout);
+    return PyLong_FromLong(status);
+}
+
+static PyObject *Machine_attach_disk(MachineObject *self, PyObject *args,
+                                     PyObject *kwds) {
+    static char *kwlist[] = {"path", "writable", NULL};
+    MmioDevice device = {BLOCK_BASE, BLOCK_SIZE, block_load, block_store,
+                         NULL};
+    PyObject *path;
+    int writable = 0;
+
+    if (check_running(self) < 0 ||
+        !PyArg_ParseTupleAndKeywords(args, kwds, "O&|p", kwlist,
+                                     PyUnicode_FSConverter, &path, &writable)) {
+        return NULL;
+    }
+    if (self->disk) {
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_RuntimeError, "a disk is already attached");
+        return NULL;
+    }
+    self->disk = block_open(PyBytes_AS_STRING(path), writable);
+    if (self->disk == NULL) {
+        PyErr_Format(PyExc_OSError, "cannot map %s", PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    device.context = self->disk;
+    if (machine_attach(self->machine, &device) != 0) {
+        block_close(self->disk);
+        self->disk = NULL;
+        PyErr_SetString(PyExc_RuntimeError, "no room on the device bus");
+        return NULL;
+    }
+    return PyLong_FromUnsignedLong(block_sectors(self->disk));
+}
+
+static PyObject *Machine_close(MachineObject *self, PyObject *unused) {
+    if (self->exports > 0) {
+        PyErr_SetString(PyExc_BufferError,
+                        "machine memory or registers are still exported");
+        return NULL;
+    }
+    free_machine(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *Machine_get_registers(MachineObject *self, void *closure) {
+    RegistersObject *registers;
+    PyObject *view;
+
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    registers = PyObject_New(RegistersObject, &RegistersType);
+    if (registers == NULL) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    registers->owner = self;
+    view = PyMemoryView_FromObject((PyObject *)registers);
+    Py_DECREF(registers);
+    return view;
+}
+
+static PyObject *Machine_get_memory(MachineObject *self, void *closure) {
+    MemoryObject *memory;
+    PyObject *view;
+
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    memory = PyObject_New(MemoryObject, &MemoryType);
+    if (memory == NULL) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    memory->owner = self;
+    view = PyMemoryView_FromObject((PyObject *)memory);
+    Py_DECREF(memory);
+    return view;
+}
+
+static PyObject *Machine_get_pc(MachineObject *self, void *closure) {
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    return PyLong_FromUnsignedLong(self->machine->processor.PC);
+}
+
+static int Machine_set_pc(MachineObject *self, PyObject *value, void *closure) {
+    unsigned long pc;
+
+    if (check_running(self) < 0) {
+        return -1;
+    }
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "cannot delete pc");
+        return -1;
+    }
+    pc = PyLong_AsUnsignedLong(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+    self->machine->processor.PC = pc;
+    return 0;
+}
+
+static PyObject *Machine_get_instret(MachineObject *self, void *closure) {
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(self->machine->processor.instret);
+}
+
+static PyObject *Machine_get_status(MachineObject *self, void *closure) {
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    return PyLong_FromLong(self->machine->processor.status);
+}
+
+static PyObject *Machine_get_program_length(MachineObject *self, void *closure) {
+    if (check_running(self) < 0) {
+        return NULL;
+    }
+    return PyLong_FromLong(self->machine->program_length);
+}
+
+static PyMethodDef Machine_methods[] = {
+    {"load", (PyCFunction)Machine_load, METH_VARARGS,
+     "load(program) -> int\n\nResets the machine, clears memory and loads a program at 0x1000, "
+     "from a path to a file of hex words or from a buffer of words. "
+     "Returns the number of instructions."},
+    {"reset", (PyCFunction)Machine_reset, METH_NOARGS,
+     "Resets registers, pc and status; memory is left alone."},
+    {"run", (PyCFunction)Machine_run, METH_VARARGS,
+     "run(n=unlimited) -> status\n\nRuns up to n instructions. Returns "
+     "RUNNING if the budget ran out, otherwise why the machine halted."},
+    {"step", (PyCFunction)Machine_step, METH_NOARGS,
+     "step() -> status\n\nRuns one instruction."},
+    {"attach_disk", (PyCFunction)Machine_attach_disk,
+     METH_VARARGS | METH_KEYWORDS,
+     "attach_disk(path, writable=False) -> int\n\nMaps a file as the block "
+     "device at 0x10002000, copy-on-write if writable, so guest writes never "
+     "reach the file. Returns the number of 512-byte sectors."},
+    {"close", (PyCFunction)Machine_close, METH_NOARGS,
+     "Frees the machine's memory, or recycles it, ahead of garbage "
+     "collection."},
+    {NULL}
+};
+
+static PyGetSetDef Machine_getset[] = {
+    {"registers", (getter)Machine_get_registers, NULL,
+     "Writable uint32 memoryview of x0..x31, aliasing the register file", NULL},
+    {"memory", (getter)Machine_get_memory, NULL,
+     "Writable byte memoryview of guest memory, aliasing it", NULL},
+    {"pc", (getter)Machine_get_pc, (setter)Machine_set_pc, "Program counter", NULL},
+    {"instret", (getter)Machine_get_instret, NULL, "Instructions retired", NULL},
+    {"status", (getter)Machine_get_status, NULL, "Halt status, RUNNING if none", NULL},
+    {"program_length", (getter)Machine_get_program_length, NULL,
+     "Instructions in the loaded program", NULL},
+    {NULL}
+};
+
+static PyBufferProcs Machine_as_buffer = {
+    (getbufferproc)Machine_getbuffer,
+    (releasebufferproc)Machine_releasebuffer,
+};
+
+static PyTypeObject MachineType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "riscvemu.Machine",
+    .tp_doc = "Machine(superblocks=True, pages='small', node=-1)\n\nAn "
+              "emulated RISC-V machine with its own memory and registers. "
+              "pages 'thp' or 'hugetlb' backs memory with a huge page; node "
+              "binds it to a NUMA node instead of the first toucher's.",
+    .tp_basicsize = sizeof(MachineObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)Machine_init,
+    .tp_dealloc = (destructor)Machine_dealloc,
+    .tp_methods = Machine_methods,
+    .tp_getset = Machine_getset,
+    .tp_as_buffer = &Machine_as_buffer,
+};
+
+static int Registers_getbuffer(RegistersObject *self, Py_buffer *view,
+                               int flags) {
+    if (check_running(self->owner) < 0) {
+        view->obj = NULL;
+        return -1;
+    }
+    view->buf = self->owner->machine->processor.R;
+    view->obj = (PyObject *)self;
+    view->len = 32 * sizeof(Register);
+    view->readonly = 0;
+    view->itemsize = sizeof(Register);
+    view->format = (flags & PyBUF_FORMAT) ? "I" : NULL;
+    view->ndim = 1;
+    view->shape = register_shape;
+    view->strides = word_stride;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    Py_INCREF(self);
+    self->owner->exports++;
+    return 0;
+}
+
+static void Registers_releasebuffer(RegistersObject *self, Py_buffer *view) {
+    self->owner->exports--;
+}
+
+static void Registers_dealloc(RegistersObject *self) {
+    Py_DECREF(self->owner);
+    PyObject_Free(self);
+}
+
+static PyBufferProcs Registers_as_buffer = {
+    (getbufferproc)Registers_getbuffer,
+    (releasebufferproc)Registers_releasebuffer,
+};
+
+static PyTypeObject RegistersType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "riscvemu.Registers",
+    .tp_basicsize = sizeof(RegistersObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)Registers_dealloc,
+    .tp_as_buffer = &Registers_as_buffer,
+};
+
+/* memoryview() asks for read-only access; machine.memory is documented
+   as writable, so it asks for write access whatever it was given */
+static int Memory_getbuffer(MemoryObject *self, Py_buffer *view, int flags) {
+    return export_memory(self->owner, (PyObject *)self, view,
+                         flags | PyBUF_WRITABLE);
+}
+
+static void Memory_releasebuffer(MemoryObject *self, Py_buffer *view) {
+    self->owner->exports--;
+    self->owner->writers--;
+}
+
+static void Memory_dealloc(MemoryObject *self) {
+    Py_DECREF(self->owner);
+    PyObject_Free(self);
+}
+
+static PyBufferProcs Memory_as_buffer = {
+    (getbufferproc)Memory_getbuffer,
+    (releasebufferproc)Memory_releasebuffer,
+};
+
+static PyTypeObject MemoryType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "riscvemu.Memory",
+    .tp_basicsize = sizeof(MemoryObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)Memory_dealloc,
+    .tp_as_buffer = &Memory_as_buffer,
+};
+
+static PyObject *riscvemu_bind_thread(PyObject *module, PyObject *args) {
+    int node;
+
+    if (!PyArg_ParseTuple(args, "i", &node)) {
+        return NULL;
+    }
+    if (machine_bind_thread(node) != 0) {
+        PyErr_Format(PyExc_OSError, "cannot run on NUMA node %d", node);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef riscvemu_methods[] = {
+    {"bind_thread", riscvemu_bind_thread, METH_VARARGS,
+     "bind_thread(node)\n\nPins the calling thread to the CPUs of a NUMA "
+     "node, e.g. in each worker before it creates machines."},
+    {NULL}
+};
+
+static struct PyModuleDef riscvemu_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "riscvemu",
+    .m_doc = "In-process RISC-V emulator (libriscvemu).",
+    .m_size = -1,
+    .m_methods = riscvemu_methods,
+};
+
+PyMODINIT_FUNC PyInit_riscvemu(void) {
+    PyObject *module;
+
+    if (PyType_Ready(&MachineType) < 0 || PyType_Ready(&RegistersType) < 0 ||
+        PyType_Ready(&MemoryType) < 0) {
+        return NULL;
+    }
+    module = PyModule_Create(&riscvemu_module);
+    if (module == NULL) {
+        return NULL;
+    }
+    Py_INCREF(&MachineType);
+    if (PyModule_AddObject(module, "Machine", (PyObject *)&MachineType) < 0 ||
+        PyModule_AddIntConstant(module, "RUNNING", MACHINE_RUNNING) < 0 ||
+        PyModule_AddIntConstant(module, "EXITED", MACHINE_EXITED) < 0 ||
+        PyModule_AddIntConstant(module, "INVALID_INSTRUCTION",
+                                MACHINE_INVALID_INSTRUCTION) < 0 ||
+        PyModule_AddIntConstant(module, "UNKNOWN_OPCODE",
+                                MACHINE_UNKNOWN_OPCODE) < 0 ||
+        PyModule_AddIntConstant(module, "ILLEGAL_ECALL",
+                                MACHINE_ILLEGAL_ECALL) < 0 ||
+        PyModule_AddIntConstant(module, "ACCESS_FAULT",
+                                MACHINE_ACCESS_FAULT) < 0 ||
+        PyModule_AddIntConstant(module, "MEMORY_SPACE", MEMORY_SPACE) < 0) {
+        Py_DECREF(&MachineType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,31 @@
+# Builds the riscvemu extension from the libriscvemu sources:
+#   python3 setup.py build_ext --inplace   (or: make python)
+import os
+from setuptools import setup, Extension
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+
+def lib_sources():
+    """The Makefile's LIB_SOURCES, so the two builds cannot disagree"""
+    with open(os.path.join(ROOT, "Makefile")) as f:
+        for line in f:
+            name, _, value = line.partition(":=")
+            if name.strip() == "LIB_SOURCES":
+                return value.split()
+    raise SystemExit("no LIB_SOURCES in ../Makefile")
+
+
+LIB_SOURCES = lib_sources()
+
+setup(
+    name="riscvemu",
+    ext_modules=[Extension(
+        "riscvemu",
+        sources=["riscvemu.c"] + [os.path.relpath(os.path.join(ROOT, s))
+                                  for s in LIB_SOURCES],
+        include_dirs=[ROOT],
+        extra_compile_args=["-O2"],
+        extra_link_args=["-pthread"],
+    )],
+)
@@ -0,0 +1,139 @@
+"""Tests for the riscvemu bindings; run with make python-test."""
+
+import array
+import unittest
+
+import riscvemu
+
+
+def addi(rd, rs1, imm):
+    return (imm & 0xFFF) << 20 | rs1 << 15 | rd << 7 | 0x13
+
+
+def bne(rs1, rs2, offset):
+    offset &= 0x1FFF
+    return ((offset >> 12 & 1) << 31 | (offset >> 5 & 0x3F) << 25 |
+            rs2 << 20 | rs1 << 15 | 1 << 12 | (offset >> 1 & 0xF) << 8 |
+            (offset >> 11 & 1) << 7 | 0x63)
+
+
+ECALL = 0x73
+BASE = 0x1000
+
+# x5 += step, ITERATIONS times, then exit; the step sits at BASE + 4
+ITERATIONS = 1000
+
+
+def counting_loop(step):
+    return array.array("I", [
+        addi(6, 0, ITERATIONS),
+        addi(5, 5, step),
+        addi(6, 6, -1),
+        bne(6, 0, -8),
+        addi(10, 0, 10),
+        ECALL,
+    ])
+
+
+class MachineTest(unittest.TestCase):
+    def machine(self, superblocks=True):
+        m = riscvemu.Machine(superblocks=superblocks)
+        self.addCleanup(m.close)
+        return m
+
+    def test_load_and_run(self):
+        for superblocks in (False, True):
+            m = self.machine(superblocks)
+            self.assertEqual(m.load(counting_loop(1)), 6)
+            self.assertEqual(m.pc, BASE)
+            self.assertEqual(m.run(), riscvemu.EXITED)
+            self.assertEqual(m.status, riscvemu.EXITED)
+            self.assertEqual(m.registers[5], ITERATIONS)
+
+    def test_run_budget(self):
+        m = self.machine()
+        m.load(counting_loop(1))
+        self.assertEqual(m.run(10), riscvemu.RUNNING)
+        self.assertEqual(m.instret, 10)
+        self.assertEqual(m.run(), riscvemu.EXITED)
+        self.assertEqual(m.registers[5], ITERATIONS)
+
+    def test_step(self):
+        m = self.machine()
+        m.load(counting_loop(1))
+        self.assertEqual(m.step(), riscvemu.RUNNING)
+        self.assertEqual(m.pc, BASE + 4)
+        self.assertEqual(m.instret, 1)
+        self.assertEqual(m.registers[6], ITERATIONS)
+
+    def test_registers_view(self):
+        m = self.machine()
+        m.load(counting_loop(1))
+        registers = m.registers
+        self.assertEqual(len(registers), 32)
+        registers[5] = 500
+        m.run()
+        self.assertEqual(registers[5], 500 + ITERATIONS)
+        del registers
+
+    def test_memory_view(self):
+        m = self.machine()
+        m.load(counting_loop(1))
+        memory = m.memory
+        self.assertEqual(len(memory), riscvemu.MEMORY_SPACE)
+        self.assertEqual(memory[BASE:BASE + 4].cast("I")[0], addi(6, 0, ITERATIONS))
+        memory[0x2000] = 0xAB
+        self.assertEqual(memoryview(m)[0x2000], 0xAB)
+        del memory
+
+    def test_plain_memoryview_is_read_only(self):
+        m = self.machine()
+        view = memoryview(m)
+        self.assertTrue(view.readonly)
+        with self.assertRaises(TypeError):
+            view[0] = 1
+        view.release()
+
+    def test_close_with_live_export(self):
+        m = riscvemu.Machine()
+        memory = m.memory
+        with self.assertRaises(BufferError):
+            m.close()
+        memory.release()
+        m.close()
+        with self.assertRaises(ValueError):
+            m.run()
+
+    def patch_step(self, memory, step):
+        memory[BASE + 4:BASE + 8] = array.array("I", [addi(5, 5, step)]).tobytes()
+
+    def test_patched_code_runs(self):
+        for superblocks in (False, True):
+            m = self.machine(superblocks)
+            m.load(counting_loop(1))
+            # stop at the step once the loop is hot, then patch it
+            m.run(1 + 3 * 100)
+            self.assertEqual(m.pc, BASE + 4)
+            memory = m.memory
+            self.patch_step(memory, 100)
+            m.run(3 * 100)
+            self.assertEqual(m.registers[5], 100 + 100 * 100)
+            # and again while the view is still live
+            self.patch_step(memory, 7)
+            m.run()
+            self.assertEqual(m.registers[5], 100 + 100 * 100 + 7 * 800)
+            memory.release()
+
+    def test_patched_code_steps(self):
+        m = self.machine()
+        m.load(counting_loop(1))
+        m.run(1 + 3 * 100)
+        with m.memory as memory:
+            self.patch_step(memory, 3)
+        m.step()
+        self.assertEqual(m.registers[5], 103)
+        m.run()
+        self.assertEqual(m.registers[5], 100 + 3 * 900)
+
+if __name__ == "__main__":
+    unittest.main()
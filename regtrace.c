@@ -0,0 +1,448 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "regtrace.h"
+#include "ring.h"
+
+#define RING_RECORDS (1U << 14)
+#define BATCH_RECORDS 256
+#define CHUNK_RECORDS 4096
+/* worst case per packed record: a tag and a 5-byte varint per register */
+#define MAX_ENCODED (32 * 6)
+#define HEADER_SIZE 12
+#define FOOTER_SIZE 24
+
+/* "r%2d=%08x " four to a line, eight lines, then a blank line */
+#define ENTRY_SIZE 13
+#define LINE_SIZE (4 * ENTRY_SIZE + 1)
+#define DUMP_SIZE (8 * LINE_SIZE + 1)
+
+typedef struct {
+    Register R[32];
+} Snapshot;
+
+struct RegTrace {
+    Ring ring;
+    RegTracePolicy policy;
+    FILE *file;
+    int packed;
+    pthread_t writer;
+    atomic_int stop;
+    /* snapshots pushed (emulator thread) and written out (writer thread) */
+    Double pushed;
+    Double dropped;
+    _Alignas(64) atomic_ullong written;
+    /* writer thread scratch */
+    char dump[DUMP_SIZE];
+    Snapshot batch[BATCH_RECORDS];
+    char text[BATCH_RECORDS * DUMP_SIZE];
+    /* packed files: the chunk being filled, the snapshot before it and the
+       offsets of the chunks already written */
+    Byte *chunk;
+    size_t chunk_length;
+    Word chunk_records;
+    Snapshot previous;
+    Double offset;
+    Double *index;
+    size_t chunks;
+    size_t index_capacity;
+    /* set by the writer thread when a write or the index fails; nothing is
+       recorded after that, and regtrace_close() reports it */
+    int error;
+};
+
+static inline Byte *put_varint(Byte *out, Word value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static inline Word zigzag(sWord value) {
+    return ((Word)value << 1) ^ (Word)(value >> 31);
+}
+
+static void put_word(Byte *out, Word value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static void put_double(Byte *out, Double value) {
+    put_word(out, (Word)value);
+    put_word(out + 4, (Word)(value >> 32));
+}
+
+static Word get_word(const Byte *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((Word)in[3] << 24);
+}
+
+static Double get_double(const Byte *in) {
+    return get_word(in) | ((Double)get_word(in + 4) << 32);
+}
+
+static void init_dump(char *dump) {
+    int r;
+
+    for (r = 0; r < 32; r++) {
+        char *entry = dump + (r / 4) * LINE_SIZE + (r % 4) * ENTRY_SIZE;
+        char name[5];
+        snprintf(name, sizeof(name), "r%2d=", r);
+        memcpy(entry, name, 4);
+        memset(entry + 4, '0', 8);
+        entry[12] = ' ';
+        if (r % 4 == 3) {
+            entry[ENTRY_SIZE] = '\n';
+        }
+    }
+    dump[DUMP_SIZE - 1] = '\n';
+}
+
+/* only the hex digits change from one dump to the next */
+static void format_dump(char *dump, const Register *R) {
+    static const char hex[] = "0123456789abcdef";
+    int r, k;
+
+    for (r = 0; r < 32; r++) {
+        char *digits = dump + (r / 4) * LINE_SIZE + (r % 4) * ENTRY_SIZE + 4;
+        Word value = R[r];
+        for (k = 7; k >= 0; k--) {
+            digits[k] = hex[value & 0xF];
+            value >>= 4;
+        }
+    }
+}
+
+static int flush_chunk(RegTrace *t) {
+    if (t->chunk_records == 0) {
+        return 0;
+    }
+    if (t->chunks == t->index_capacity) {
+        size_t capacity = t->index_capacity ? t->index_capacity * 2 : 256;
+        Double *index = realloc(t->index, capacity * sizeof(Double));
+        if (index == NULL) {
+            t->error = 1;
+            return -1;
+        }
+        t->index = index;
+        t->index_capacity = capacity;
+    }
+    if (fwrite(t->chunk, 1, t->chunk_length, t->file) != t->chunk_length) {
+        t->error = 1;
+        return -1;
+    }
+    t->index[t->chunks++] = t->offset;
+    t->offset += t->chunk_length;
+    t->chunk_length = 0;
+    t->chunk_records = 0;
+    return 0;
+}
+
+static void pack(RegTrace *t, const Snapshot *s) {
+    Byte *out = t->chunk + t->chunk_length;
+    int r, last;
+
+    // a chunk that could not be written is never reset, so stop here
+    if (t->error) {
+        return;
+    }
+    if (t->chunk_records == 0) {
+        // each chunk starts from full registers, so it decodes on its own
+        for (r = 0; r < 32; r++) {
+            put_word(out, s->R[r]);
+            out += 4;
+        }
+    } else {
+        for (last = 31; last >= 0 && s->R[last] == t->previous.R[last]; last--)
+            ;
+        if (last < 0) {
+            *out++ = REGTRACE_SAME;
+        }
+        for (r = 0; r <= last; r++) {
+            if (s->R[r] != t->previous.R[r]) {
+                *out++ = r | (r < last ? REGTRACE_MORE : 0);
+                out = put_varint(out, zigzag((sWord)(s->R[r] - t->previous.R[r])));
+            }
+        }
+    }
+    t->chunk_length = out - t->chunk;
+    t->previous = *s;
+    if (++t->chunk_records == CHUNK_RECORDS) {
+        flush_chunk(t);
+    }
+}
+
+static void *writer_main(void *arg) {
+    RegTrace *t = arg;
+    struct timespec idle = {0, 100000};
+
+    for (;;) {
+        size_t i, n = ring_pop(&t->ring, t->batch, BATCH_RECORDS);
+        char *out = t->text;
+
+        if (n == 0) {
+            if (atomic_load(&t->stop) && ring_count(&t->ring) == 0) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if (t->packed) {
+                pack(t, &t->batch[i]);
+            } else {
+                format_dump(t->dump, t->batch[i].R);
+                memcpy(out, t->dump, DUMP_SIZE);
+                out += DUMP_SIZE;
+            }
+        }
+        if (out != t->text && !t->error &&
+            fwrite(t->text, 1, out - t->text, t->file) != (size_t)(out - t->text)) {
+            t->error = 1;
+        }
+        atomic_fetch_add(&t->written, n);
+    }
+    return NULL;
+}
+
+static int start(RegTrace *t) {
+    init_dump(t->dump);
+    atomic_init(&t->stop, 0);
+    atomic_init(&t->written, 0);
+    if (ring_init(&t->ring, sizeof(Snapshot), RING_RECORDS) != 0) {
+        return -1;
+    }
+    if (pthread_create(&t->writer, NULL, writer_main, t) != 0) {
+        ring_free(&t->ring);
+        return -1;
+    }
+    return 0;
+}
+
+RegTrace *regtrace_open(FILE *file, RegTracePolicy policy) {
+    RegTrace *t = calloc(1, sizeof(RegTrace));
+
+    if (t == NULL) {
+        return NULL;
+    }
+    t->policy = policy;
+    t->file = file;
+    if (start(t) != 0) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+RegTrace *regtrace_open_packed(const char *path) {
+    RegTrace *t = calloc(1, sizeof(RegTrace));
+    Byte header[HEADER_SIZE] = {'R', 'V', 'R', 'T', REGTRACE_VERSION};
+
+    if (t == NULL) {
+        return NULL;
+    }
+    t->policy = REGTRACE_BLOCK;
+    t->packed = 1;
+    t->chunk = malloc(CHUNK_RECORDS * MAX_ENCODED);
+    t->file = t->chunk ? fopen(path, "wb") : NULL;
+    if (t->file == NULL) {
+        free(t->chunk);
+        free(t);
+        return NULL;
+    }
+    put_word(header + 8, CHUNK_RECORDS);
+    t->offset = sizeof(header);
+
+    if (fwrite(header, 1, sizeof(header), t->file) != sizeof(header) ||
+        start(t) != 0) {
+        fclose(t->file);
+        free(t->chunk);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+int regtrace_close(RegTrace *t) {
+    int status;
+
+    atomic_store(&t->stop, 1);
+    pthread_join(t->writer, NULL);
+    if (t->dropped) {
+        fprintf(stderr, "Register trace dropped %llu of %llu snapshots\n",
+                (unsigned long long)t->dropped,
+                (unsigned long long)(t->pushed + t->dropped));
+    }
+    if (t->packed) {
+        Byte entry[8], footer[FOOTER_SIZE];
+        size_t i;
+
+        if (!t->error) {
+            flush_chunk(t);
+        }
+        // without the footer, regtrace_dump() rejects a partial file
+        for (i = 0; i < t->chunks && !t->error; i++) {
+            put_double(entry, t->index[i]);
+            if (fwrite(entry, 1, sizeof(entry), t->file) != sizeof(entry)) {
+                t->error = 1;
+            }
+        }
+        if (!t->error) {
+            put_double(footer, t->pushed);
+            put_double(footer + 8, t->offset);
+            put_word(footer + 16, t->chunks);
+            memcpy(footer + 20, "RVRI", 4);
+            if (fwrite(footer, 1, sizeof(footer), t->file) != sizeof(footer)) {
+                t->error = 1;
+            }
+        }
+        if (fclose(t->file) != 0) {
+            t->error = 1;
+        }
+        free(t->chunk);
+        free(t->index);
+    } else if (fflush(t->file) != 0) {
+        t->error = 1;
+    }
+    if (t->error) {
+        fprintf(stderr, "Register trace incomplete: a write or its index "
+                "failed\n");
+    }
+    status = t->error ? -1 : 0;
+    ring_free(&t->ring);
+    free(t);
+    return status;
+}
+
+void regtrace_record(RegTrace *t, const Processor *p) {
+    const Snapshot *s = (const Snapshot *)p->R;
+
+    if (t->policy == REGTRACE_DROP) {
+        if (!ring_push(&t->ring, s)) {
+            t->dropped++;
+            return;
+        }
+    } else {
+        ring_push_wait(&t->ring, s);
+    }
+    t->pushed++;
+}
+
+void regtrace_sync(RegTrace *t) {
+    while (atomic_load(&t->written) != t->pushed) {
+        sched_yield();
+    }
+}
+
+/* Decodes one chunk, printing the records numbered first to last */
+static int dump_chunk(const Byte *in, size_t length, Double number,
+                      Double first, Double last, char *dump, FILE *out) {
+    const Byte *end = in + length;
+    Register R[32];
+    int r;
+
+    if (length < 32 * 4) {
+        return -1;
+    }
+    for (r = 0; r < 32; r++, in += 4) {
+        R[r] = get_word(in);
+    }
+    for (;; number++) {
+        if (number >= first) {
+            format_dump(dump, R);
+            fwrite(dump, 1, DUMP_SIZE, out);
+        }
+        if (number == last || in == end) {
+            return 0;
+        }
+        if (*in == REGTRACE_SAME) {
+            in++;
+            continue;
+        }
+        for (;;) {
+            Byte tag = *in++;
+            Word delta = 0;
+            int shift = 0;
+
+            do {
+                if (in == end || shift > 28) {
+                    return -1;
+                }
+                delta |= (Word)(*in & 0x7F) << shift;
+                shift += 7;
+            } while (*in++ & 0x80);
+            R[tag & 0x1F] += (delta >> 1) ^ (Word)-(sWord)(delta & 1);
+            if (!(tag & REGTRACE_MORE)) {
+                break;
+            }
+            if (in == end) {
+                return -1;
+            }
+        }
+    }
+}
+
+int regtrace_dump(const char *path, Double first, Double count, FILE *out) {
+    FILE *file = fopen(path, "rb");
+    Byte header[HEADER_SIZE], footer[FOOTER_SIZE], entry[16];
+    Double records, index_offset, last, start, end;
+    Word chunk, chunks, k;
+    Byte *buffer = NULL;
+    char dump[DUMP_SIZE];
+    int status = -1;
+
+    if (file == NULL) {
+        return -1;
+    }
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, "RVRT", 4) != 0 || header[4] != REGTRACE_VERSION ||
+        fseek(file, -FOOTER_SIZE, SEEK_END) != 0 ||
+        fread(footer, 1, sizeof(footer), file) != sizeof(footer) ||
+        memcmp(footer + 20, "RVRI", 4) != 0) {
+        goto done;
+    }
+    chunk = get_word(header + 8);
+    records = get_double(footer);
+    index_offset = get_double(footer + 8);
+    chunks = get_word(footer + 16);
+    if (chunk == 0 || (records + chunk - 1) / chunk != chunks) {
+        goto done;
+    }
+    init_dump(dump);
+    if (count == 0 || first >= records) {
+        status = 0;
+        goto done;
+    }
+    last = count > records - first ? records - 1 : first + count - 1;
+
+    for (k = first / chunk; k <= last / chunk; k++) {
+        // a chunk runs from its index entry to the next one, or the index
+        if (fseek(file, index_offset + (Double)k * 8, SEEK_SET) != 0 ||
+            fread(entry, 1, k + 1 < chunks ? 16 : 8, file) != (k + 1 < chunks ? 16 : 8)) {
+            goto done;
+        }
+        start = get_double(entry);
+        end = k + 1 < chunks ? get_double(entry + 8) : index_offset;
+        if (end < start || end - start > (Double)chunk * MAX_ENCODED) {
+            goto done;
+        }
+        free(buffer);
+        buffer = malloc(end - start);
+        if (buffer == NULL || fseek(file, start, SEEK_SET) != 0 ||
+            fread(buffer, 1, end - start, file) != end - start ||
+            dump_chunk(buffer, end - start, (Double)k * chunk, first, last,
+                       dump, out) != 0) {
+            goto done;
+        }
+    }
+    status = 0;
+done:
+    free(buffer);
+    fclose(file);
+    return status;
+}
@@ -0,0 +1,64 @@
+#ifndef REGTRACE_H
+#define REGTRACE_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Register dump trace (-r) off the emulator thread. Each retired
+   instruction copies its 32 registers into a lock-free ring; a writer
+   thread formats them, byte for byte as print_registers() does, and writes
+   large blocks to the stream. When the ring is full the emulator either
+   waits for room (REGTRACE_BLOCK, a complete trace) or drops the snapshot
+   and counts it (REGTRACE_DROP, execution never stalls).
+
+   The same snapshots can go to a packed trace file (-R) instead, read back
+   a window at a time with regtrace_dump(). File format, little endian:
+     header  "RVRT" u8 version u8 reserved[3] u32 chunk
+     chunks  of chunk instructions each (the last may be shorter): the
+             first instruction's 32 registers as u32, then for each later
+             one the registers that changed, as u8 (reg | REGTRACE_MORE if
+             another follows) and varint zigzag(value - previous value),
+             or a lone REGTRACE_SAME byte if none did
+     index   u64 file offset of each chunk
+     footer  u64 instructions u64 index offset u32 chunks "RVRI"
+   varints are LEB128. Instruction 0 is the first one retired. */
+
+#define REGTRACE_VERSION 1
+#define REGTRACE_MORE 0x20
+#define REGTRACE_SAME 0x40
+
+typedef enum {
+    REGTRACE_BLOCK,
+    REGTRACE_DROP,
+} RegTracePolicy;
+
+typedef struct RegTrace RegTrace;
+
+/* Returns NULL if the writer cannot start */
+RegTrace *regtrace_open(FILE *, RegTracePolicy);
+
+/* A packed trace file; never drops, since every instruction needs its
+   snapshot. Returns NULL if the file cannot be opened or the writer cannot
+   start. */
+RegTrace *regtrace_open_packed(const char *path);
+
+/* Drains the ring and stops the writer; a packed file gets its index and
+   is closed, a stream stays open. Reports dropped snapshots, if any, on
+   stderr. If a write failed (a full disk) or the chunk index could not
+   grow, recording stopped there: this says so on stderr and returns -1,
+   and a packed file is left without its footer, so regtrace_dump()
+   rejects it rather than reading a truncated trace as complete. */
+int regtrace_close(RegTrace *);
+
+void regtrace_record(RegTrace *, const Processor *);
+
+/* Waits until everything recorded so far has reached the stream, e.g.
+   before the guest prints to the same stream */
+void regtrace_sync(RegTrace *);
+
+/* Prints instructions first to first + count - 1 of a packed trace as -r
+   would have, decoding only the chunks they are in. Returns -1 if the file
+   is unreadable or not a complete packed trace. */
+int regtrace_dump(const char *path, Double first, Double count, FILE *out);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+#define HEADER_BYTES 8
+#define BUFFER_BYTES (1 << 16)
+/* worst case per event: kind byte plus two 10-byte varints */
+#define MAX_ENCODED 21
+
+struct Replay {
+    FILE *file;
+    int replaying;
+    int diverged;
+    Double instret;
+    Double value[REPLAY_KINDS];
+    /* events taken or logged, and where a replay went its own way */
+    Double events;
+    Double diverged_at;
+};
+
+static Byte *put_varint(Byte *out, Double value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+/* returns -1 at the end of the file or on a varint that is too long */
+static int get_varint(FILE *file, Double *value) {
+    int c, shift;
+
+    *value = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(file)) == EOF) {
+            return -1;
+        }
+        *value |= (Double)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static Double zigzag(Double value) {
+    return (value << 1) ^ (Double)((int64_t)value >> 63);
+}
+
+static Double unzigzag(Double value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+static Replay *open_log(const char *path, int replaying) {
+    Replay *r = calloc(1, sizeof(Replay));
+    Byte header[HEADER_BYTES] = {'R', 'V', 'R', 'P', REPLAY_VERSION};
+    Byte found[HEADER_BYTES];
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->replaying = replaying;
+    r->file = fopen(path, replaying ? "rb" : "wb");
+    if (r->file == NULL) {
+        free(r);
+        return NULL;
+    }
+    setvbuf(r->file, NULL, _IOFBF, BUFFER_BYTES);
+    if (replaying ? fread(found, 1, HEADER_BYTES, r->file) != HEADER_BYTES ||
+                        memcmp(found, header, 5) != 0
+                  : fwrite(header, 1, HEADER_BYTES, r->file) != HEADER_BYTES) {
+        fclose(r->file);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+Replay *replay_record(const char *path) {
+    return open_log(path, 0);
+}
+
+Replay *replay_open(const char *path) {
+    return open_log(path, 1);
+}
+
+void replay_close(Replay *r) {
+    if (r->diverged) {
+        fprintf(stderr,
+                "Replay diverged from the log at instruction %llu "
+                "(input %llu); later inputs came from the host\n",
+                (unsigned long long)r->diverged_at,
+                (unsigned long long)r->events);
+    }
+    fclose(r->file);
+    free(r);
+}
+
+int replay_take(Replay *r, ReplayKind kind, Double instret, Double *value) {
+    Double delta, change;
+    int c;
+
+    if (!r->replaying || r->diverged) {
+        return 0;
+    }
+    c = getc(r->file);
+    if (c != (int)kind || get_varint(r->file, &delta) != 0 ||
+        r->instret + delta != instret || get_varint(r->file, &change) != 0) {
+        r->diverged = 1;
+        r->diverged_at = instret;
+        return 0;
+    }
+    r->instret = instret;
+    r->value[kind] += unzigzag(change);
+    *value = r->value[kind];
+    r->events++;
+    return 1;
+}
+
+void replay_log(Replay *r, ReplayKind kind, Double instret, Double value) {
+    Byte event[MAX_ENCODED], *p = event;
+
+    if (r->replaying) {
+        return;
+    }
+    *p++ = kind;
+    p = put_varint(p, instret - r->instret);
+    p = put_varint(p, zigzag(value - r->value[kind]));
+    fwrite(event, 1, p - event, r->file);
+    r->instret = instret;
+    r->value[kind] = value;
+    r->events++;
+}
@@ -0,0 +1,51 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "types.h"
+
+/* Record/replay of the host-dependent inputs a guest reads (-j, -J). The
+   program, -v and every ecall so far are deterministic, so today the only
+   such input is the time CSR; an input that is added later logs through
+   the same two calls under a kind of its own. A run replayed from a log
+   with the same program and options is bit-identical to the recorded one,
+   and it takes no more than a file read per input. Logs do not depend on
+   the execution mode: one recorded with superblocks replays under -n or
+   -t, since inputs are matched by retired instruction count.
+
+   File format, little endian:
+     header  "RVRP" u8 version u8 reserved[3]
+     event   u8 kind, varint (instret - previous event's instret),
+             varint zigzag(value - previous value of the same kind)
+   instret is the number of instructions retired before the read, and
+   previous values start at 0. varints are LEB128 of up to 64 bits.
+
+   A replay that finds a different kind, a different instruction count or
+   the end of the log has diverged: from then on inputs come from the host
+   again, and replay_close() reports where it happened. */
+
+#define REPLAY_VERSION 1
+
+typedef enum {
+    REPLAY_TIME = 1,
+    REPLAY_KINDS,
+} ReplayKind;
+
+typedef struct Replay Replay;
+
+/* Return NULL if the file cannot be opened (or is not a replay log) */
+Replay *replay_record(const char *path);
+Replay *replay_open(const char *path);
+
+/* Flushes a log being recorded and closes the file; reports on stderr if a
+   replay diverged */
+void replay_close(Replay *);
+
+/* On replay, stores the logged value of the input read at instret in
+   *value and returns 1. Otherwise returns 0: the caller reads the host and
+   passes what it got to replay_log(). */
+int replay_take(Replay *, ReplayKind, Double instret, Double *value);
+
+/* Appends an input to a log being recorded; a no-op on replay */
+void replay_log(Replay *, ReplayKind, Double instret, Double value);
+
+#endif
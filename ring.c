@@ -0,0 +1,82 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+int ring_init(Ring *ring, size_t record_size, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->buffer = malloc(size * record_size);
+    if (ring->buffer == NULL) {
+        return -1;
+    }
+    ring->record_size = record_size;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->cached_head = 0;
+    ring->cached_tail = 0;
+    return 0;
+}
+
+void ring_free(Ring *ring) {
+    free(ring->buffer);
+    ring->buffer = NULL;
+}
+
+int ring_push(Ring *ring, const void *record) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - ring->cached_tail > ring->mask) {
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->cached_tail > ring->mask) {
+            return 0;
+        }
+    }
+    memcpy(ring->buffer + (head & ring->mask) * ring->record_size, record,
+           ring->record_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+void ring_push_wait(Ring *ring, const void *record) {
+    while (!ring_push(ring, record)) {
+        sched_yield();
+    }
+}
+
+size_t ring_pop(Ring *ring, void *records, size_t max) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t n, first;
+
+    if (ring->cached_head == tail) {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+    n = ring->cached_head - tail;
+    if (n > max) {
+        n = max;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    // copy in at most two pieces around the wrap point
+    first = ring->mask + 1 - (tail & ring->mask);
+    if (first > n) {
+        first = n;
+    }
+    memcpy(records, ring->buffer + (tail & ring->mask) * ring->record_size,
+           first * ring->record_size);
+    memcpy((unsigned char *)records + first * ring->record_size, ring->buffer,
+           (n - first) * ring->record_size);
+
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+size_t ring_count(Ring *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
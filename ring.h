@@ -0,0 +1,37 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Single-producer/single-consumer lock-free ring of fixed-size records.
+   The emulator thread pushes, a writer thread pops. Capacity is rounded up
+   to a power of two. */
+typedef struct {
+    unsigned char *buffer;
+    size_t record_size;
+    size_t mask;
+    /* producer and consumer indices live on separate cache lines */
+    _Alignas(64) atomic_size_t head; /* written by the producer */
+    size_t cached_tail;
+    _Alignas(64) atomic_size_t tail; /* written by the consumer */
+    size_t cached_head;
+} Ring;
+
+/* Returns 0 on success, -1 if the buffer cannot be allocated */
+int ring_init(Ring *, size_t record_size, size_t capacity);
+void ring_free(Ring *);
+
+/* Producer side: copies one record in, returns 0 if the ring is full */
+int ring_push(Ring *, const void *record);
+
+/* Producer side: spins (yielding) until there is room */
+void ring_push_wait(Ring *, const void *record);
+
+/* Consumer side: copies up to max records out, returns the count */
+size_t ring_pop(Ring *, void *records, size_t max);
+
+/* Either side: number of records currently queued */
+size_t ring_count(Ring *);
+
+#endif
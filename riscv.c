@@ -1,4 +1,16 @@
 #include "riscv.h"
+#include "block.h"
+#include "bpred.h"
+#include "cfg.h"
+#include "isa.h"
+#include "machine.h"
+#include "memtrace.h"
+#include "mmio.h"
+#include "regtrace.h"
+#include "replay.h"
+#include "superblock.h"
+#include "trap.h"
+#include "trigger.h"
 #include <assert.h>
 #include <getopt.h>
 #include <stdarg.h>
@@ -12,13 +24,154 @@
 /* WARNING: DO NOT CHANGE THIS FILE.
  YOU PROBABLY DON'T EVEN NEED TO LOOK AT IT... */
 
-// Pointer to simulator memory
-Byte *memory;
-#define MAX_SIZE 50
+// The machine being simulated
+static Machine *machine;
+
+// Branch predictor under evaluation (-b), reported at exit
+static BranchPredictor *branch_predictor;
+
+static void report_branch_predictor(void) {
+  bpred_report(branch_predictor, stderr);
+  bpred_destroy(branch_predictor);
+}
+
+// Guest load/store trace (-m), flushed at exit
+static MemTrace *memory_trace;
+
+static void close_memory_trace(void) { memtrace_close(memory_trace); }
+
+// Host-dependent inputs recorded (-j) or replayed (-J), closed at exit
+static Replay *input_log;
+
+static void close_input_log(void) { replay_close(input_log); }
+
+// Block device file, read-only (-D) or copy-on-write (-W), unmapped at exit
+static Block *disk;
+
+static void close_disk(void) { block_close(disk); }
+
+static void print_registers(Processor *processor) {
+  int i, j;
+
+  for (i = 0; i < 8; i++) {
+    for (j = 0; j < 4; j++) {
+      printf("r%2d=%08x ", i * 4 + j, processor->R[i * 4 + j]);
+    }
+
+    puts("");
+  }
+
+  printf("\n");
+}
+
+// -r dumps outside interactive sessions, formatted by a writer thread
+static RegTrace *register_trace;
+
+static void close_register_trace(void) { regtrace_close(register_trace); }
+
+// Packed register trace (-R), indexed at exit
+static RegTrace *packed_trace;
+
+static void close_packed_trace(void) { regtrace_close(packed_trace); }
+
+/* Guest output and error messages share stdout with the -r dumps, so
+   everything queued is written before an instruction that may print runs:
+   ecalls and CSR accesses, invalid encodings, faulting vector accesses and
+   loads or stores outside memory. This runs after every traced
+   instruction, so it looks at the opcode class and the decode table
+   (isa.h) rather than decoding the next instruction in full. */
+static void drain_before_output(Processor *processor) {
+  Word bits, cls;
+  Address base;
+  IsaOp op;
+
+  if (processor->PC > MEMORY_SPACE - 4) {
+    regtrace_sync(register_trace);
+    return;
+  }
+  bits = load(machine->memory, processor->PC, LENGTH_WORD);
+  cls = isa_opcode_class[bits & 0x7F];
+  op = isa_decode(bits);
+  base = processor->R[(bits >> 15) & 0x1F];
+  if (op == ISA_INVALID || cls == ISA_CLASS_ECALL || cls == ISA_CLASS_VECTOR ||
+      (op == ISA_SRLI && (bits >> 25) != 0x00) ||
+      (op == ISA_SRAI && (bits >> 25) != 0x20) ||
+      (cls == ISA_CLASS_LOAD &&
+       mmio_outside(base + isa_imm_i(bits), 1U << ((bits >> 12) & 0x3))) ||
+      (cls == ISA_CLASS_STORE &&
+       mmio_outside(base + isa_imm_s(bits), 1U << ((bits >> 12) & 0x3))))
+    regtrace_sync(register_trace);
+}
+
+static void trace_registers(Processor *processor) {
+  if (packed_trace)
+    regtrace_record(packed_trace, processor);
+  if (register_trace) {
+    regtrace_record(register_trace, processor);
+    drain_before_output(processor);
+  }
+}
+
+// -T conditions, and where the run is as seen from the hook
+static Trigger trigger;
+static int opt_triggers;
+static Double trigger_index;
+static Address trigger_pc;
+
+/* traces only what the triggers select */
+static void trace_triggered(Processor *processor) {
+  Address pc = trigger_pc;
+
+  trigger_pc = processor->PC;
+  if (trigger_check(&trigger, trigger_index++, pc, processor, machine->memory))
+    trace_registers(processor);
+  else if (register_trace)
+    drain_before_output(processor);
+}
+
+/* Runs up to budget instructions. With -T the run goes untraced up to the
+   window (unless a write watch must see every instruction), instruction by
+   instruction through it and untraced again after it. */
+static MachineStatus run_traced(Double budget, InstructionHook hook) {
+  Processor *processor = &machine->processor;
+  MachineStatus status;
+  Double n, span;
+
+  if (hook == NULL || !opt_triggers)
+    return machine_run(machine, budget, hook, NULL);
+
+  trigger_index = 0;
+  if (!trigger_watches(&trigger) && trigger.start > 0) {
+    status = machine_run(machine, trigger.start < budget ? trigger.start : budget,
+                         NULL, &n);
+    trigger_index = n;
+    budget -= n;
+    if (status != MACHINE_RUNNING || budget == 0)
+      return status;
+  }
+  trigger_pc = processor->PC;
+  span = !trigger.stop ? budget
+         : trigger.stop > trigger_index ? trigger.stop - trigger_index : 0;
+  status = machine_run(machine, span < budget ? span : budget, trace_triggered,
+                       &n);
+  budget -= n;
+  if (status != MACHINE_RUNNING || budget == 0)
+    return status;
+  if (register_trace)
+    regtrace_sync(register_trace);
+  return machine_run(machine, budget, NULL, NULL);
+}
 
 void execute(Processor *processor, int prompt, int print) {
+  Address pc;
+
+  /* interrupts are taken between instructions */
+  trap_poll(processor);
+  pc = processor->PC;
   /* fetch an instruction */
-  uint32_t instruction_bits = load(memory, processor->PC, LENGTH_WORD);
+  Word instruction_bits;
+  if (!fetch(processor, machine->memory, &instruction_bits))
+    return;
 
   /* interactive-mode prompt */
   if (prompt) {
@@ -32,62 +185,72 @@ void execute(Processor *processor, int prompt, int print) {
     decode_instruction(instruction_bits);
   }
 
-  execute_instruction(instruction_bits, processor, memory);
+  execute_instruction(instruction_bits, processor, machine->memory);
 
   // enforce $0 being hard-wired to 0
   processor->R[0] = 0;
+  if (processor->status) {
+    return;
+  }
+  processor->instret++;
+  if (opt_triggers && !trigger_check(&trigger, processor->instret - 1, pc,
+                                     processor, machine->memory)) {
+    return;
+  }
 
   // print trace
   if (print) {
-    int i, j;
-
-    for (i = 0; i < 8; i++) {
-      for (j = 0; j < 4; j++) {
-        printf("r%2d=%08x ", i * 4 + j, processor->R[i * 4 + j]);
-      }
-
-      puts("");
-    }
-
-    printf("\n");
+    print_registers(processor);
+  }
+  if (packed_trace) {
+    regtrace_record(packed_trace, processor);
   }
 }
 
-int load_program(uint8_t *mem, size_t memsize, int startaddr,
-                 const char *filename, int disasm) {
-  FILE *file = fopen(filename, "r");
-  char line[MAX_SIZE];
-  int instruction, offset = 0;
-  int programsize = 0;
-  while (fgets(line, MAX_SIZE, file) != NULL) {
-    instruction = (int32_t)strtol(line, NULL, 16);
-    programsize++;
-    mem[startaddr + offset] = instruction & 0xFF;
-    mem[startaddr + offset + 1] = (instruction >> 8) & 0xFF;
-    mem[startaddr + offset + 2] = (instruction >> 16) & 0xFF;
-    mem[startaddr + offset + 3] = (instruction >> 24) & 0xFF;
-
-    if (disasm) {
-      printf("%08x: ", startaddr + offset);
-      decode_instruction((uint32_t)instruction);
-    }
-
-    offset += 4;
+/* The process exit code for a halted machine, as when errors called exit() */
+static int exit_code(MachineStatus status) {
+  switch (status) {
+  case MACHINE_EXITED:
+    return 0;
+  case MACHINE_UNKNOWN_OPCODE:
+    return EXIT_FAILURE;
+  default:
+    return -1;
   }
-  return programsize;
 }
 
 int main(int argc, char **argv) {
   /* options */
   int opt_disasm = 0, opt_regdump = 0, opt_interactive = 0, opt_exit = 0,
-      opt_init_reg = 0;
-
-  /* the architectural state of the CPU */
-  Processor processor;
+      opt_init_reg = 0, opt_superblocks = 1;
+  const char *opt_memtrace = NULL;
+  /* -H backs guest memory with huge pages; -N binds it and the emulator
+   * thread to a NUMA node */
+  MachinePages opt_pages = MACHINE_PAGES_SMALL;
+  int opt_node = -1;
+  /* -j records the host-dependent inputs to a log, -J replays one */
+  const char *opt_record = NULL, *opt_replay = NULL;
+  /* -D maps a file as the block device read-only, -W copy-on-write */
+  const char *opt_disk = NULL;
+  int opt_disk_writable = 0;
+  /* -R writes a packed register trace; -x FIRST[:COUNT] prints part of one */
+  const char *opt_packed = NULL;
+  int opt_extract = 0;
+  unsigned long long extract_first = 0, extract_count = 1;
+  /* -l labels the -d listing, -g writes the control flow graph */
+  int opt_labels = 0;
+  const char *opt_cfg = NULL;
+  /* record the first sample_burst of every sample_period accesses */
+  unsigned long sample_period = 1, sample_burst = 1;
+  /* -w drop: a full register trace queue drops dumps instead of waiting */
+  RegTracePolicy trace_policy = REGTRACE_BLOCK;
+  /* -d worker threads, one per online CPU unless -p says otherwise */
+  int opt_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  char *end;
 
   /* parse the command-line args */
   int c;
-  while ((c = getopt(argc, argv, "dvrite")) != -1) {
+  while ((c = getopt(argc, argv, "dvriteb:m:s:np:lg:w:R:x:T:j:J:H:N:D:W:")) != -1) {
     switch (c) {
     case 'd':
       opt_disasm = 1;
@@ -107,62 +270,295 @@ int main(int argc, char **argv) {
     case 'e':
       opt_exit = 1;
       break;
+    case 'b':
+      branch_predictor = bpred_create(optarg);
+      if (branch_predictor == NULL) {
+        fprintf(stderr, "Unknown branch predictor %s (expected one of: %s)\n",
+                optarg, bpred_names);
+        return -1;
+      }
+      break;
+    case 'n':
+      opt_superblocks = 0;
+      break;
+    case 'p':
+      opt_threads = atoi(optarg);
+      break;
+    case 'l':
+      opt_disasm = 1;
+      opt_labels = 1;
+      break;
+    case 'g':
+      opt_cfg = optarg;
+      break;
+    case 'm':
+      opt_memtrace = optarg;
+      break;
+    case 'R':
+      opt_packed = optarg;
+      break;
+    case 'H':
+      if (strcmp(optarg, "small") == 0) {
+        opt_pages = MACHINE_PAGES_SMALL;
+      } else if (strcmp(optarg, "thp") == 0) {
+        opt_pages = MACHINE_PAGES_TRANSPARENT;
+      } else if (strcmp(optarg, "hugetlb") == 0) {
+        opt_pages = MACHINE_PAGES_HUGETLB;
+      } else {
+        fprintf(stderr, "Unknown page size %s (expected small, thp or hugetlb)\n",
+                optarg);
+        return -1;
+      }
+      break;
+    case 'N':
+      opt_node = (int)strtol(optarg, &end, 10);
+      if (*end != '\0' || opt_node < 0) {
+        fprintf(stderr, "Bad NUMA node %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'j':
+      opt_record = optarg;
+      break;
+    case 'J':
+      opt_replay = optarg;
+      break;
+    case 'D':
+    case 'W':
+      opt_disk = optarg;
+      opt_disk_writable = c == 'W';
+      break;
+    case 'x':
+      opt_extract = 1;
+      extract_first = strtoull(optarg, &end, 0);
+      extract_count = *end == ':' ? strtoull(end + 1, &end, 0) : 1;
+      if (*end != '\0') {
+        fprintf(stderr, "Bad trace window %s (expected FIRST or FIRST:COUNT)\n",
+                optarg);
+        return -1;
+      }
+      break;
+    case 'T':
+      if (!opt_triggers) {
+        trigger_init(&trigger);
+        opt_triggers = 1;
+      }
+      if (trigger_parse(&trigger, optarg) != 0) {
+        fprintf(stderr, "Bad trigger %s (expected N:M, pc=LO:HI or write=ADDR, "
+                "and at most one write=)\n", optarg);
+        return -1;
+      }
+      break;
+    case 'w':
+      if (strcmp(optarg, "block") == 0) {
+        trace_policy = REGTRACE_BLOCK;
+      } else if (strcmp(optarg, "drop") == 0) {
+        trace_policy = REGTRACE_DROP;
+      } else {
+        fprintf(stderr, "Unknown trace policy %s (expected block or drop)\n",
+                optarg);
+        return -1;
+      }
+      break;
+    case 's':
+      /* N or N:B */
+      sample_period = strtoul(optarg, &end, 0);
+      sample_burst = *end == ':' ? strtoul(end + 1, &end, 0) : 1;
+      if (*end != '\0' || sample_period == 0 || sample_burst == 0) {
+        fprintf(stderr, "Bad sampling %s (expected N or N:B)\n", optarg);
+        return -1;
+      }
+      break;
     default:
       fprintf(stderr, "Bad option %c\n", c);
       return -1;
     }
   }
 
+  if (opt_record && opt_replay) {
+    fprintf(stderr, "Cannot record (-j) and replay (-J) in the same run\n");
+    return -1;
+  }
+
   /* make sure we got an executable filename on the command line */
   if (argc <= optind) {
     fprintf(stderr, "Give me an executable file to run!\n");
     return -1;
   }
 
+  /* -x reads a packed trace instead of running anything */
+  if (opt_extract) {
+    if (regtrace_dump(argv[optind], extract_first, extract_count, stdout) != 0) {
+      fprintf(stderr, "Cannot read packed trace %s\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+    return 0;
+  }
+
   /* load the executable into memory */
-  assert(memory == NULL);
-  memory = calloc(MEMORY_SPACE, sizeof(uint8_t)); // allocate zeroed memory
-  assert(memory != NULL);
-  int prog_numins = 0;
-  /* SEt the PC to 0x1000 */
-  processor.PC = 0x1000;
-  prog_numins = load_program(memory, MEMORY_SPACE, processor.PC, argv[optind],
-                             opt_disasm);
+  /* the thread first, so the registers and superblocks are local too */
+  if (opt_node >= 0 && machine_bind_thread(opt_node) != 0) {
+    fprintf(stderr, "Cannot run on NUMA node %d\n", opt_node);
+    return -1;
+  }
+  machine = machine_create_placed(opt_superblocks && !opt_interactive,
+                                  opt_pages, opt_node);
+  if (machine == NULL && opt_node >= 0) {
+    fprintf(stderr, "Cannot place guest memory on NUMA node %d\n", opt_node);
+    return -1;
+  }
+  assert(machine != NULL);
+  Processor *processor = &machine->processor;
+  int prog_numins = machine_load_program(machine, argv[optind]);
+  if (prog_numins < 0) {
+    fprintf(stderr, "Cannot load %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  Byte *memory = machine->memory;
+  /* static analysis: the control flow graph and a symbolic listing */
+  if (opt_cfg || opt_labels) {
+    const Word *image = (const Word *)(memory + processor->PC);
+    ControlFlowGraph *cfg = cfg_build(image, prog_numins, processor->PC);
+    int status = 0;
+
+    if (cfg == NULL) {
+      fprintf(stderr, "Out of memory building the control flow graph\n");
+      return EXIT_FAILURE;
+    }
+    if (opt_cfg) {
+      size_t length = strlen(opt_cfg);
+      FILE *file = fopen(opt_cfg, "w");
+      if (file == NULL) {
+        fprintf(stderr, "Cannot write control flow graph %s\n", opt_cfg);
+        cfg_free(cfg);
+        return EXIT_FAILURE;
+      }
+      if (length >= 5 && strcmp(opt_cfg + length - 5, ".json") == 0)
+        cfg_write_json(cfg, file);
+      else
+        cfg_write_dot(cfg, file);
+      fclose(file);
+    }
+    if (opt_labels &&
+        disassemble_symbolic(cfg, image, prog_numins, stdout) != 0)
+      status = EXIT_FAILURE;
+    cfg_free(cfg);
+    if (status || opt_labels || !opt_disasm)
+      return status;
+  }
   /* if we're just disassembling,exit here */
   if (opt_disasm) {
+    if (disassemble_program((const Word *)(memory + processor->PC), prog_numins,
+                            processor->PC, stdout, opt_threads) != 0) {
+      return EXIT_FAILURE;
+    }
     return 0;
   }
 
-  /* initialize the CPU */
-  /* zero out all registers */
+  /* initialize the CPU: machine_create() zeroed the registers and set gp,
+   * sp and the PC; -v starts every register, x0 included, at 4 instead */
   int i;
-  for (i = 0; i < 32; i++) {
-    if (!opt_init_reg)
-      processor.R[i] = 0;
-    else
-      processor.R[i] = 4;
+  if (opt_init_reg) {
+    for (i = 0; i < 32; i++)
+      processor->R[i] = 4;
+    processor->R[3] = 0x3000;
+    processor->R[2] = 0xEFFFF;
+  }
+
+  /* reported from atexit, since the run may end in exit() */
+  processor->bpred = branch_predictor;
+  if (branch_predictor) {
+    atexit(report_branch_predictor);
+  }
+
+  processor->memtrace = NULL;
+  if (opt_memtrace) {
+    memory_trace = memtrace_open(opt_memtrace, sample_period, sample_burst);
+    if (memory_trace == NULL) {
+      fprintf(stderr, "Cannot write memory trace %s\n", opt_memtrace);
+      return -1;
+    }
+    processor->memtrace = memory_trace;
+    atexit(close_memory_trace);
+  }
+
+  processor->replay = NULL;
+  if (opt_record || opt_replay) {
+    input_log = opt_record ? replay_record(opt_record) : replay_open(opt_replay);
+    if (input_log == NULL) {
+      fprintf(stderr, opt_record ? "Cannot write replay log %s\n"
+                                 : "Cannot read replay log %s\n",
+              opt_record ? opt_record : opt_replay);
+      return -1;
+    }
+    processor->replay = input_log;
+    atexit(close_input_log);
+  }
+
+  if (opt_disk) {
+    MmioDevice device = {BLOCK_BASE, BLOCK_SIZE, block_load, block_store,
+                         NULL};
+
+    disk = block_open(opt_disk, opt_disk_writable);
+    if (disk == NULL) {
+      fprintf(stderr, "Cannot map block device %s\n", opt_disk);
+      return -1;
+    }
+    atexit(close_disk);
+    device.context = disk;
+    if (machine_attach(machine, &device) != 0) {
+      fprintf(stderr, "Cannot attach block device %s\n", opt_disk);
+      return -1;
+    }
   }
 
-  /* Set the global pointer to 0x3000. We arbitrarily call this the middle of
-   * the static data segment */
-  processor.R[3] = 0x3000;
+  if (opt_regdump && !opt_interactive) {
+    register_trace = regtrace_open(stdout, trace_policy);
+    if (register_trace == NULL) {
+      fprintf(stderr, "Cannot start the register trace writer\n");
+      return -1;
+    }
+    atexit(close_register_trace);
+  }
+  if (opt_packed) {
+    packed_trace = regtrace_open_packed(opt_packed);
+    if (packed_trace == NULL) {
+      fprintf(stderr, "Cannot write packed trace %s\n", opt_packed);
+      return -1;
+    }
+    atexit(close_packed_trace);
+  }
 
-  /* Set the stack pointer near the top of the memory array */
-  processor.R[2] = 0xEFFFF;
+  if (opt_triggers)
+    trigger_arm(&trigger, memory);
 
   int simins = 0;
 
+  /* superblocks (unless -n) run everything except interactive sessions */
+  if (!opt_interactive) {
+    MachineStatus status =
+        run_traced(opt_exit ? UINT64_MAX : (Double)prog_numins,
+                   (opt_regdump || opt_packed) ? trace_registers : NULL);
+    if (status != MACHINE_RUNNING) {
+      exit(exit_code(status));
+    }
+    return 0;
+  }
+
   if (opt_exit) {
     /* simulate forever! */
-    while (1) {
-      execute(&processor, opt_interactive, opt_regdump);
+    while (!processor->status) {
+      execute(processor, opt_interactive, opt_regdump);
     }
   } else {
     /* Either simulate for program instructions */
-    while (simins < prog_numins) {
-      execute(&processor, opt_interactive, opt_regdump);
+    while (simins < prog_numins && !processor->status) {
+      execute(processor, opt_interactive, opt_regdump);
       simins++;
     }
   }
+  if (processor->status) {
+    exit(exit_code(processor->status));
+  }
   return 0;
 }
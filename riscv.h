@@ -3,12 +3,136 @@
 
 #include "types.h"
 
-/* see part1.c */
+#include <stdio.h>
+
+/* One instruction's line, for -i; prints nothing for an unknown opcode */
 void decode_instruction(uint32_t instruction_bits);
 
+/* Bulk disassembly: decode_instruction() lines with "%08x: " address
+   prefixes. A block needs count * DISASM_MAX_LINE bytes of output space.
+   An opcode outside the decode table (isa.h) stops the listing right after
+   its address, as execution stops on it. */
+#define DISASM_MAX_LINE 64
+#define DISASM_BATCH 256
+#define DISASM_CHUNK 16384
+size_t disassemble_block(const Word *words, size_t count, Address base,
+                         char *out, int *stopped);
+/* Splits images of more than one chunk across up to threads threads; the
+   output is the same as a serial run. Returns -1 if the listing was cut
+   short by an unknown opcode. */
+int disassemble_program(const Word *words, size_t count, Address base,
+                        FILE *file, int threads);
+
+/* Zicsr counters. All are read-only: cycle and instret count retired
+   instructions (there is no timing model, so every instruction is one
+   cycle) and time counts microseconds of host monotonic clock since
+   time_base, or what the -J log says it was (replay.h). The h CSRs hold the
+   upper 32 bits. */
+#define CSR_CYCLE 0xC00
+#define CSR_TIME 0xC01
+#define CSR_INSTRET 0xC02
+#define CSR_CYCLEH 0xC80
+#define CSR_TIMEH 0xC81
+#define CSR_INSTRETH 0xC82
+#define CSR_TIMEBASE_HZ 1000000
+
+/* vector state (vector.h), read-only as well */
+#define CSR_VL 0xC20
+#define CSR_VTYPE 0xC21
+#define CSR_VLENB 0xC22
+
+/* Machine-mode trap CSRs (trap.h), the only writable ones. cycle also
+   counts the cycles wfi spends waiting, so after a wfi it runs ahead of
+   instret. */
+#define CSR_MSTATUS 0x300
+#define CSR_MIE 0x304
+#define CSR_MTVEC 0x305
+#define CSR_MSCRATCH 0x340
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define CSR_MTVAL 0x343
+#define CSR_MIP 0x344
+
+/* SYSTEM encodings other than ecall and the CSR instructions; any other
+   funct3 0 word is still an ecall */
+#define INSTRUCTION_MRET 0x30200073
+#define INSTRUCTION_WFI 0x10500073
+
+/* Bulk memory ecalls: a1 is the destination, a2 the source (or the fill
+   byte for memset) and a3 the length in bytes; a0 returns the destination.
+   Each runs as one host memmove or memset, so overlapping copies behave
+   like memmove either way. A range outside memory halts the machine with
+   MACHINE_ACCESS_FAULT, without copying anything. */
+#define ECALL_MEMCPY 12
+#define ECALL_MEMSET 13
+#define ECALL_MEMMOVE 14
+
+/* Block device transfers (block.h): a1 is the guest address, a2 the first
+   sector and a3 the number of sectors; a0 returns the status. Without a
+   block device they halt the machine with MACHINE_ACCESS_FAULT. */
+#define ECALL_BLOCK_READ 15
+#define ECALL_BLOCK_WRITE 16
+
+/* Reads a counter as of instret retired instructions; returns 0 if the CSR
+   does not exist */
+int read_csr(const Processor *, Word csr, Double instret, Register *value);
+/* Writes a CSR; returns 0 if it is read-only or does not exist */
+int write_csr(Processor *, Word csr, Register value);
+/* csrrs/csrrc with rs1 (or uimm) 0 only read; anything else writes */
+int csr_writes(Word instruction_bits);
+Double host_clock_ns(void);
+/* "cycle" and so on, or NULL */
+const char *csr_name(Word csr);
+
 /* see part2.c */
 void execute_instruction(uint32_t instruction_bits, Processor* processor, Byte *memory);
 void store(Byte *memory, Address address, Alignment alignment, Word value);
 Word load(Byte *memory, Address address, Alignment alignment);
 
+/* Does [address, address + length) lie in guest memory, without wrapping? */
+static inline int in_memory(Address address, Double length) {
+    return length <= MEMORY_SPACE && address <= MEMORY_SPACE - length;
+}
+
+/* Instruction fetch at the PC. Returns 0, having printed a Bad Read and
+   halted the machine with MACHINE_ACCESS_FAULT, if the PC left memory. */
+int fetch(Processor *, Byte *memory, Word *instruction_bits);
+
+/* div and rem as RISC-V defines them where C would trap: x / 0 is -1 and
+   x % 0 is x; INT32_MIN / -1 overflows to INT32_MIN, remainder 0 */
+static inline sWord riscv_div(sWord dividend, sWord divisor) {
+    return divisor == 0 ? -1
+         : dividend == INT32_MIN && divisor == -1 ? dividend
+         : dividend / divisor;
+}
+
+static inline sWord riscv_rem(sWord dividend, sWord divisor) {
+    return divisor == 0 ? dividend
+         : dividend == INT32_MIN && divisor == -1 ? 0
+         : dividend % divisor;
+}
+
+/* Guest memory is followed by a bitmap with a bit for each MEMORY_PAGE
+   bytes, set once the page is written, so that recycling a machine
+   (machine_clear_memory) zeroes only the pages the last run wrote. store()
+   sets the bits itself; every other writer of guest memory calls
+   memory_dirty() for the range it wrote. */
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE (1U << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGES (MEMORY_SPACE >> MEMORY_PAGE_SHIFT)
+#define MEMORY_DIRTY_BYTES (MEMORY_PAGES / 8)
+
+static inline void memory_dirty(Byte *memory, Address address, Word length) {
+    Byte *bitmap = memory + MEMORY_SPACE;
+    Word page, last;
+
+    if (length == 0) {
+        return;
+    }
+    last = (address + length - 1) >> MEMORY_PAGE_SHIFT;
+    for (page = address >> MEMORY_PAGE_SHIFT; page <= last; page++) {
+        bitmap[page >> 3] |= 1U << (page & 7);
+    }
+}
+
 #endif
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+#include "superblock.h"
+#include "riscv.h"
+#include "utils.h"
+
+#define LOOKUP_MASK (SB_MAX_BLOCKS * 2 - 1)
+#define PC_SLOT(pc, mask) (((pc) >> 2) & (mask))
+
+SuperblockCache *sb_create(void) {
+    SuperblockCache *sb = calloc(1, sizeof(SuperblockCache));
+    if (sb) {
+        sb_flush(sb);
+    }
+    return sb;
+}
+
+void sb_destroy(SuperblockCache *sb) {
+    free(sb);
+}
+
+void sb_flush(SuperblockCache *sb) {
+    sb->count = 0;
+    sb->generation++;
+    sb->code_lo = 0xFFFFFFFF;
+    sb->code_hi = 0;
+    memset(sb->lookup, 0, sizeof(sb->lookup));
+}
+
+static Superblock *lookup(SuperblockCache *sb, Address pc) {
+    Word i = PC_SLOT(pc, LOOKUP_MASK);
+    for (; sb->lookup[i]; i = (i + 1) & LOOKUP_MASK) {
+        if (sb->lookup[i]->entry == pc) {
+            return sb->lookup[i];
+        }
+    }
+    return NULL;
+}
+
+static void profile_branch(SuperblockCache *sb, Address pc, int taken) {
+    BranchProfile *bp = &sb->profile[PC_SLOT(pc, 4095)];
+    if (bp->pc != pc) {
+        bp->pc = pc;
+        bp->taken = 0;
+        bp->not_taken = 0;
+    }
+    if (taken) {
+        bp->taken++;
+    } else {
+        bp->not_taken++;
+    }
+}
+
+/* Follow the direction the profile says is more frequent; without a profile,
+   assume backward branches close loops and are taken */
+static int predict_taken(SuperblockCache *sb, Address pc, sWord offset) {
+    BranchProfile *bp = &sb->profile[PC_SLOT(pc, 4095)];
+    if (bp->pc == pc && bp->taken + bp->not_taken > 0) {
+        return bp->taken > bp->not_taken;
+    }
+    return offset < 0;
+}
+
+static Superblock *form(SuperblockCache *sb, Address entry, Byte *memory) {
+    Address pcs[SB_MAX_LENGTH];
+    Address pc = entry;
+    Superblock *block;
+    int i, n = 0;
+
+    if (sb->count == SB_MAX_BLOCKS) {
+        sb_flush(sb);
+    }
+    block = &sb->blocks[sb->count];
+
+    while (n < SB_MAX_LENGTH && pc <= MEMORY_SPACE - 4) {
+        DecodedInstruction *d = &block->code[n];
+
+        for (i = 0; i < n; i++) {
+            if (pcs[i] == pc) {
+                goto done; // the path loops back into itself
+            }
+        }
+        pcs[n++] = pc;
+        if (pc < sb->code_lo) {
+            sb->code_lo = pc;
+        }
+        if (pc + 4 > sb->code_hi) {
+            sb->code_hi = pc + 4;
+        }
+
+        decode(load(memory, pc, LENGTH_WORD), d);
+        if (!(d->flags & DECODED_BRANCH)) {
+            d->next = n - 1;
+        }
+        if (d->flags & DECODED_FALLBACK) {
+            break;
+        } else if (d->flags & DECODED_BRANCH) {
+            d->next = predict_taken(sb, pc, d->imm) ? pc + d->imm : pc + 4;
+            pc = d->next;
+        } else if (d->flags & DECODED_JUMP) {
+            pc += d->imm;
+        } else {
+            pc += 4;
+        }
+    }
+done:
+    if (n == 0) {
+        return NULL;
+    }
+    fuse_pairs(block->code, n);
+    detect_bulk_idiom(block->code, n, entry, &block->idiom);
+
+    block->entry = entry;
+    block->length = n;
+    block->link_pc[0] = block->link_pc[1] = 0;
+    block->link[0] = block->link[1] = NULL;
+    block->next_link = 0;
+    sb->count++;
+
+    i = PC_SLOT(entry, LOOKUP_MASK);
+    while (sb->lookup[i]) {
+        i = (i + 1) & LOOKUP_MASK;
+    }
+    sb->lookup[i] = block;
+    return block;
+}
+
+/* Block for a PC that starts a basic block, forming one if it became hot */
+static Superblock *enter(SuperblockCache *sb, Address pc, Byte *memory) {
+    Superblock *block = lookup(sb, pc);
+    uint16_t *heat = &sb->heat[PC_SLOT(pc, 4095)];
+
+    if (block == NULL && ++*heat >= SB_HOT_THRESHOLD) {
+        *heat = 0;
+        block = form(sb, pc, memory);
+    }
+    return block;
+}
+
+static Superblock *successor(SuperblockCache *sb, Superblock *block,
+                             Address pc, Byte *memory) {
+    Superblock *next;
+    Word generation = sb->generation;
+
+    if (block->link_pc[0] == pc && block->link[0]) {
+        return block->link[0];
+    }
+    if (block->link_pc[1] == pc && block->link[1]) {
+        return block->link[1];
+    }
+    next = enter(sb, pc, memory);
+    // forming next may have flushed the cache, block included
+    if (next && sb->generation == generation) {
+        block->link_pc[block->next_link] = pc;
+        block->link[block->next_link] = next;
+        block->next_link ^= 1;
+    }
+    return next;
+}
+
+/* Does every byte of the element hold the same value, as memset needs? */
+static int uniform(Word value, int size) {
+    Word mask = size == 4 ? 0xFFFFFFFF : (1U << (size * 8)) - 1;
+    return (value & mask) == ((value & 0xFF) * 0x01010101U & mask);
+}
+
+/* Runs up to max iterations of a fill or copy loop as one memset or
+   memmove (word copies go through lw's sign extension), leaving at least
+   the last iteration to the block. Returns how many it ran: 0 if a range
+   leaves memory or covers cached code, the fill value is not one repeated
+   byte, or a copy onto the bytes just ahead of its source would smear
+   rather than move them. */
+static Word run_bulk(SuperblockCache *sb, const BulkIdiom *b, Processor *p,
+                     Byte *memory, Double max) {
+    sWord distance = (sWord)(p->R[b->bound] - p->R[b->counter]);
+    Word n, bytes, dst, src, j;
+    int i;
+
+    if (distance == INT32_MIN || distance % b->counter_step != 0 ||
+        distance / b->counter_step < 2) {
+        return 0;
+    }
+    n = distance / b->counter_step - 1;
+    if (n > MEMORY_SPACE) {
+        return 0;
+    }
+    if (n > max) {
+        n = max;
+    }
+    bytes = n * b->size;
+    dst = p->R[b->dst] + b->dst_offset;
+    if (n == 0 || !in_memory(dst, bytes) ||
+        (dst < sb->code_hi && dst + bytes > sb->code_lo)) {
+        return 0;
+    }
+    if (b->kind == BULK_COPY) {
+        src = p->R[b->src] + b->src_offset;
+        if (!in_memory(src, bytes) || (src < dst && dst < src + bytes)) {
+            return 0;
+        }
+        if (b->size == LENGTH_WORD) {
+            // lw's sign extension changes the words it copies, as op_lw does
+            for (j = 0; j < bytes; j += 4) {
+                store(memory, dst + j, LENGTH_WORD,
+                      sign_extend_number(load(memory, src + j, LENGTH_WORD),
+                                         LENGTH_WORD));
+            }
+        } else {
+            memmove(memory + dst, memory + src, bytes);
+        }
+    } else {
+        if (!uniform(p->R[b->src], b->size)) {
+            return 0;
+        }
+        memset(memory + dst, p->R[b->src] & 0xFF, bytes);
+    }
+    memory_dirty(memory, dst, bytes);
+    for (i = 0; i < b->inductions; i++) {
+        p->R[b->reg[i]] += n * b->step[i];
+    }
+    return n;
+}
+
+/* Runs the block until its end, a side exit, a flush or the budget runs out */
+static Double run_block(SuperblockCache *sb, Superblock *block, Processor *p,
+                        Byte *memory, Double budget, InstructionHook hook) {
+    Word generation = sb->generation;
+    Double skipped = 0;
+    int i, n = block->length;
+
+    if (block->idiom.kind != BULK_NONE && !hook && !p->bpred && !p->memtrace) {
+        skipped = (Double)run_bulk(sb, &block->idiom, p, memory, budget / n) * n;
+        budget -= skipped;
+    }
+    if (budget < (Double)n) {
+        n = budget;
+    }
+    for (i = 0; i < n;) {
+        const DecodedInstruction *d = &block->code[i];
+
+        /* fused pairs only run when nobody observes the state in between */
+        if (d->fused && !hook && i + 1 < n) {
+            d->fused(d, p, memory);
+            i += 2;
+            d++;
+        } else {
+            d->execute(d, p, memory);
+            if (p->status) {
+                break; // only fallbacks halt: ecall exit, invalid encodings
+            }
+            if (hook) {
+                hook(p);
+            }
+            i++;
+        }
+        if (d->flags) {
+            if ((d->flags & DECODED_BRANCH) && p->PC != d->next) {
+                break; // side exit
+            }
+            if ((d->flags & DECODED_STORE) &&
+                (sb->generation != generation || p->yield)) {
+                break; // overwrote cached code, or to a device that yields
+            }
+        }
+    }
+    p->instret += skipped + i;
+    return skipped + i;
+}
+
+Double sb_run(SuperblockCache *sb, Processor *p, Byte *memory, Double budget,
+              InstructionHook hook) {
+    Double executed = 0;
+    /* blocks rely on x0 already being 0; the cold path restores it */
+    int block_start = p->R[0] == 0;
+
+    while (executed < budget) {
+        DecodedInstruction d;
+        Address pc;
+        Word bits;
+
+        if (block_start) {
+            Superblock *block = enter(sb, p->PC, memory);
+            while (block) {
+                Word generation = sb->generation;
+                executed += run_block(sb, block, p, memory, budget - executed, hook);
+                if (executed >= budget || p->status || p->yield) {
+                    return executed;
+                }
+                block = sb->generation == generation
+                            ? successor(sb, block, p->PC, memory)
+                            : enter(sb, p->PC, memory);
+            }
+        }
+
+        // cold path: one decoded instruction at a time, profiling branches
+        pc = p->PC;
+        if (!fetch(p, memory, &bits)) {
+            return executed;
+        }
+        decode(bits, &d);
+        d.execute(&d, p, memory);
+        p->R[0] = 0; // only differs from 0 at startup (-v)
+        if (p->status) {
+            return executed;
+        }
+        p->instret++;
+        if (hook) {
+            hook(p);
+        }
+        executed++;
+        if (p->yield) {
+            return executed;
+        }
+
+        if (d.flags & DECODED_BRANCH) {
+            profile_branch(sb, pc, p->PC != pc + 4);
+        }
+        block_start = (d.flags & (DECODED_BRANCH | DECODED_JUMP | DECODED_FALLBACK)) != 0;
+    }
+    return executed;
+}
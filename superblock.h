@@ -0,0 +1,84 @@
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include "types.h"
+#include "decode.h"
+
+/* Superblock execution: a middle tier between the plain interpreter and a
+   JIT. Cold code runs one decoded instruction at a time while branch
+   outcomes and jump targets are profiled. Once a block entry becomes hot, the
+   path through it is laid out as a straight-line run of decoded instructions,
+   following each conditional branch's more frequent direction and jal
+   targets. Leaving the predicted path is a side exit. Ends of blocks (and
+   their most recent side exits) are linked directly to the next block.
+   A block that is one iteration of a fill or copy loop (BulkIdiom) runs
+   all but the last of its remaining iterations as one host memset or
+   memmove when no hook, branch predictor or memory trace is watching. */
+
+#define SB_MAX_LENGTH 64
+#define SB_MAX_BLOCKS 1024
+#define SB_HOT_THRESHOLD 16
+
+typedef struct Superblock Superblock;
+
+struct Superblock {
+    Address entry;
+    int length;
+    /* successor blocks keyed by the PC execution left at */
+    Address link_pc[2];
+    Superblock *link[2];
+    int next_link;
+    BulkIdiom idiom;
+    DecodedInstruction code[SB_MAX_LENGTH];
+};
+
+typedef struct {
+    Address pc;
+    Word taken;
+    Word not_taken;
+} BranchProfile;
+
+typedef struct SuperblockCache {
+    /* addresses covered by cached blocks: [code_lo, code_hi) */
+    Address code_lo;
+    Address code_hi;
+    /* bumped by every flush so running blocks notice they went stale */
+    Word generation;
+    int count;
+    Superblock *lookup[SB_MAX_BLOCKS * 2];
+    uint16_t heat[4096];
+    BranchProfile profile[4096];
+    Superblock blocks[SB_MAX_BLOCKS];
+} SuperblockCache;
+
+/* Called after each retired instruction, e.g. for -r register dumps */
+typedef void (*InstructionHook)(Processor *);
+
+SuperblockCache *sb_create(void);
+void sb_destroy(SuperblockCache *);
+
+/* Drops every block, e.g. after guest code was overwritten */
+void sb_flush(SuperblockCache *);
+
+/* Runs up to budget instructions, returns how many were executed. Stops
+   early, without counting the instruction, once p->status is set. */
+Double sb_run(SuperblockCache *, Processor *, Byte *memory, Double budget,
+              InstructionHook hook);
+
+/* Writes of any length into guest memory call this so self-modifying code
+   never runs stale blocks; the range must lie in memory, so it cannot wrap */
+static inline void sb_check_range(SuperblockCache *sb, Address address,
+                                  Word bytes) {
+    if (sb && bytes > 0 && address < sb->code_hi &&
+        address + bytes > sb->code_lo) {
+        sb_flush(sb);
+    }
+}
+
+/* Stores call this, the one-access case of sb_check_range() */
+static inline void sb_check_store(SuperblockCache *sb, Address address,
+                                  Alignment alignment) {
+    sb_check_range(sb, address, alignment);
+}
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "utils.h"
 #include "types.h"
+#include "isa.h"
 
 void test_sign_extend_number();
 void test_parse_instruction_rtype();
@@ -12,6 +13,12 @@ void test_parse_instruction_stype();
 void test_parse_instruction_sbtype();
 void test_parse_instruction_ujtype();
 void test_parse_instruction_utype();
+void test_parse_instruction_csr();
+void test_parse_instruction_vector();
+void test_parse_instruction_unknown();
+void test_offsets();
+void test_isa_imm();
+void test_isa_decode();
 
 int main(int arc, char **argv) {
     CU_pSuite pSuite1 = NULL;
@@ -53,6 +60,30 @@ int main(int arc, char **argv) {
         goto exit;
     }
 
+    if (!CU_add_test(pSuite1, "test_parse_instruction_csr", test_parse_instruction_csr)) {
+        goto exit;
+    }
+
+    if (!CU_add_test(pSuite1, "test_parse_instruction_vector", test_parse_instruction_vector)) {
+        goto exit;
+    }
+
+    if (!CU_add_test(pSuite1, "test_parse_instruction_unknown", test_parse_instruction_unknown)) {
+        goto exit;
+    }
+
+    if (!CU_add_test(pSuite1, "test_offsets", test_offsets)) {
+        goto exit;
+    }
+
+    if (!CU_add_test(pSuite1, "test_isa_imm", test_isa_imm)) {
+        goto exit;
+    }
+
+    if (!CU_add_test(pSuite1, "test_isa_decode", test_isa_decode)) {
+        goto exit;
+    }
+
 
 
     CU_basic_set_mode(CU_BRM_VERBOSE);
@@ -130,3 +161,76 @@ void test_parse_instruction_ujtype() {
     CU_ASSERT_EQUAL(inst.ujtype.rd, 1);
     CU_ASSERT_EQUAL(inst.ujtype.imm, 0);
 }
+
+void test_parse_instruction_csr() {
+    Instruction inst;
+    inst = parse_instruction(0xC02024F3); // csrrs x9, instret, x0
+    CU_ASSERT_EQUAL(inst.itype.opcode, 0x73);
+    CU_ASSERT_EQUAL(inst.itype.funct3, 0x2);
+    CU_ASSERT_EQUAL(inst.itype.rd, 9);
+    CU_ASSERT_EQUAL(inst.itype.rs1, 0);
+    CU_ASSERT_EQUAL(inst.itype.imm, 0xC02);
+}
+
+void test_parse_instruction_vector() {
+    Instruction inst;
+    inst = parse_instruction(0x030EB457); // vadd.vi v8, v16, -3
+    CU_ASSERT_EQUAL(inst.rtype.opcode, 0x57);
+    CU_ASSERT_EQUAL(inst.rtype.rd, 8);
+    CU_ASSERT_EQUAL(inst.rtype.funct3, 0x3);
+    CU_ASSERT_EQUAL(inst.rtype.rs1, 29); // simm5
+    CU_ASSERT_EQUAL(inst.rtype.rs2, 16);
+    CU_ASSERT_EQUAL(inst.rtype.funct7, 0x01); // funct6 0, vm 1
+}
+
+void test_parse_instruction_unknown() {
+    Instruction inst;
+    inst = parse_instruction(0x0000007B); // no such opcode; must not exit
+    CU_ASSERT_EQUAL(inst.bits, 0x0000007B);
+    CU_ASSERT_FALSE(is_valid_opcode(inst.opcode));
+    CU_ASSERT_TRUE(is_valid_opcode(0x33));
+}
+
+void test_offsets() {
+    Instruction inst;
+    inst = parse_instruction(0xFE0A9EE3); // bne x21, x0, -4
+    CU_ASSERT_EQUAL(get_branch_offset(inst), -4);
+    inst = parse_instruction(0x7E000FE3); // beq x0, x0, 4094
+    CU_ASSERT_EQUAL(get_branch_offset(inst), 4094);
+    inst = parse_instruction(0xFF9FF06F); // jal x0, -8
+    CU_ASSERT_EQUAL(get_jump_offset(inst), -8);
+    inst = parse_instruction(0x800000EF); // jal x1, -1048576
+    CU_ASSERT_EQUAL(get_jump_offset(inst), -1048576);
+    inst = parse_instruction(0xFE852E23); // sw x8, -4(x10)
+    CU_ASSERT_EQUAL(get_store_offset(inst), -4);
+}
+
+void test_isa_imm() {
+    CU_ASSERT_EQUAL(isa_imm_i(0xFFF00513), -1);   // addi x10, x0, -1
+    CU_ASSERT_EQUAL(isa_imm_i(0x7FF00513), 2047);
+    CU_ASSERT_EQUAL(isa_imm_s(0x80052023), -2048); // sw x0, -2048(x10)
+    CU_ASSERT_EQUAL(isa_imm_b(0xFE0A9EE3), -4);
+    CU_ASSERT_EQUAL(isa_imm_b(0x00000463), 8);     // beq x0, x0, 8
+    CU_ASSERT_EQUAL(isa_imm_u(0xFFFFF437), (sWord)0xFFFFF000);
+    CU_ASSERT_EQUAL(isa_imm_j(0x7FFFF06F), 1048574);
+    CU_ASSERT_EQUAL(isa_imm_j(0x0080006F), 8);     // jal x0, 8
+}
+
+void test_isa_decode() {
+    CU_ASSERT_EQUAL(isa_decode(0x009402b3), ISA_ADD);
+    CU_ASSERT_EQUAL(isa_decode(0x409402b3), ISA_SUB);
+    CU_ASSERT_EQUAL(isa_decode(0x029402b3), ISA_MUL);
+    CU_ASSERT_EQUAL(isa_decode(0x049402b3), ISA_INVALID); // funct7 0x02
+    CU_ASSERT_EQUAL(isa_decode(0x40355513), ISA_SRAI);    // srai x10, x10, 3
+    CU_ASSERT_EQUAL(isa_decode(0x00355513), ISA_SRLI);
+    CU_ASSERT_EQUAL(isa_decode(0x014aa023), ISA_SW);
+    CU_ASSERT_EQUAL(isa_decode(0x00003063), ISA_INVALID); // branch funct3 3
+    CU_ASSERT_EQUAL(isa_decode(0xC02024F3), ISA_CSRRS);
+    CU_ASSERT_EQUAL(isa_decode(0x00000073), ISA_ECALL);
+    CU_ASSERT_EQUAL(isa_decode(0x1000302b), ISA_DOT8);    // funct7 8
+    CU_ASSERT_EQUAL(isa_decode(0x1c00302b), ISA_INVALID); // funct7 14
+    CU_ASSERT_EQUAL(isa_decode(0x030EB457), ISA_VECTOR);
+    CU_ASSERT_EQUAL(isa_decode(0x0000007B), ISA_INVALID);
+    CU_ASSERT_STRING_EQUAL(isa_info[ISA_DOT8].mnemonic, "dot8");
+    CU_ASSERT_EQUAL(isa_info[ISA_LW].format, ISA_FMT_LOAD);
+}
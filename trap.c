@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include "trap.h"
+#include "riscv.h"
+
+/* mip: what the CLINT has pending as of instret */
+static Word pending(const Processor *p, Double instret) {
+    Word mip = (p->trap.msip & 1) ? MIP_MSIP : 0;
+
+    if (trap_mtime(p, instret) >= p->trap.mtimecmp) {
+        mip |= MIP_MTIP;
+    }
+    return mip;
+}
+
+int trap_read_csr(const Processor *p, Word csr, Double instret,
+                  Register *value) {
+    const TrapState *t = &p->trap;
+
+    switch (csr) {
+        case CSR_MSTATUS: *value = t->mstatus | MSTATUS_MPP; break;
+        case CSR_MIE: *value = t->mie; break;
+        case CSR_MTVEC: *value = t->mtvec; break;
+        case CSR_MSCRATCH: *value = t->mscratch; break;
+        case CSR_MEPC: *value = t->mepc; break;
+        case CSR_MCAUSE: *value = t->mcause; break;
+        case CSR_MTVAL: *value = t->mtval; break;
+        case CSR_MIP: *value = pending(p, instret); break;
+        default: return 0;
+    }
+    return 1;
+}
+
+int trap_write_csr(Processor *p, Word csr, Register value) {
+    TrapState *t = &p->trap;
+
+    switch (csr) {
+        case CSR_MSTATUS:
+            t->mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE);
+            break;
+        case CSR_MIE: t->mie = value & (MIP_MSIP | MIP_MTIP); break;
+        case CSR_MTVEC: t->mtvec = value & ~0x2U; break; // modes 0 and 1
+        case CSR_MSCRATCH: t->mscratch = value; break;
+        case CSR_MEPC: t->mepc = value & ~0x3U; break;
+        case CSR_MCAUSE: t->mcause = value; break;
+        case CSR_MTVAL: t->mtval = value; break;
+        case CSR_MIP: break; // both bits belong to the CLINT
+        default: return 0;
+    }
+    p->yield = 1;
+    return 1;
+}
+
+int clint_load(void *context, Processor *p, Byte *memory, Word offset,
+               Alignment length, Double instret, Word *value) {
+    Double mtime = trap_mtime(p, instret);
+    Word word;
+
+    if ((offset & 3) + length > 4) {
+        return 0;
+    }
+    switch (offset & ~3U) {
+        case CLINT_MSIP: word = p->trap.msip; break;
+        case CLINT_MTIMECMP: word = (Word)p->trap.mtimecmp; break;
+        case CLINT_MTIMECMP + 4: word = (Word)(p->trap.mtimecmp >> 32); break;
+        case CLINT_MTIME: word = (Word)mtime; break;
+        case CLINT_MTIME + 4: word = (Word)(mtime >> 32); break;
+        default: return 0;
+    }
+    *value = mmio_extend(word >> (offset & 3) * 8, length);
+    return 1;
+}
+
+int clint_store(void *context, Processor *p, Byte *memory, Word offset,
+                Alignment length, Double instret, Word value) {
+    TrapState *t = &p->trap;
+    Word register_offset = offset & ~3U;
+    Word shift = (offset & 3) * 8;
+    Word mask = length == LENGTH_WORD ? 0xFFFFFFFF
+                                      : ((1U << (length * 8)) - 1) << shift;
+    Double mtime = trap_mtime(p, instret);
+    Word word;
+
+    if (!clint_load(context, p, memory, register_offset, LENGTH_WORD, instret,
+                    &word) ||
+        (offset & 3) + length > 4) {
+        return 0;
+    }
+    word = (word & ~mask) | ((value << shift) & mask);
+    switch (register_offset) {
+        case CLINT_MSIP:
+            t->msip = word & 1;
+            break;
+        case CLINT_MTIMECMP:
+            t->mtimecmp = (t->mtimecmp & ~(Double)0xFFFFFFFF) | word;
+            break;
+        case CLINT_MTIMECMP + 4:
+            t->mtimecmp = (t->mtimecmp & 0xFFFFFFFF) | (Double)word << 32;
+            break;
+        case CLINT_MTIME:
+            t->idle = ((mtime & ~(Double)0xFFFFFFFF) | word) - instret;
+            break;
+        case CLINT_MTIME + 4:
+            t->idle = ((mtime & 0xFFFFFFFF) | (Double)word << 32) - instret;
+            break;
+    }
+    p->yield = 1;
+    return 1;
+}
+
+void trap_mret(Processor *p) {
+    TrapState *t = &p->trap;
+
+    p->PC = t->mepc;
+    t->mstatus = ((t->mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+    p->yield = 1;
+}
+
+void trap_wfi(Processor *p, Double instret) {
+    TrapState *t = &p->trap;
+    Double mtime = trap_mtime(p, instret);
+
+    // wake as the timer fires: mtime reaches mtimecmp as wfi retires
+    if (!(pending(p, instret) & t->mie) && (t->mie & MIP_MTIP) &&
+        t->mtimecmp > mtime + 1) {
+        t->idle += t->mtimecmp - (mtime + 1);
+    }
+    p->PC += 4;
+    p->yield = 1;
+}
+
+int trap_poll(Processor *p) {
+    TrapState *t = &p->trap;
+    Word ready = pending(p, p->instret) & t->mie;
+    Word cause;
+
+    p->yield = 0;
+    if (!(t->mstatus & MSTATUS_MIE) || ready == 0) {
+        return 0;
+    }
+    // software interrupts outrank timer interrupts
+    cause = (ready & MIP_MSIP) ? INTERRUPT_SOFTWARE : INTERRUPT_TIMER;
+    t->mepc = p->PC;
+    t->mcause = MCAUSE_INTERRUPT | cause;
+    t->mtval = 0;
+    t->mstatus = MSTATUS_MPIE;
+    p->PC = (t->mtvec & ~0x3U) +
+            ((t->mtvec & MTVEC_VECTORED) ? 4 * cause : 0);
+    return 1;
+}
+
+Double trap_horizon(const Processor *p) {
+    const TrapState *t = &p->trap;
+    Double mtime = trap_mtime(p, p->instret);
+
+    if (!(t->mstatus & MSTATUS_MIE) || !(t->mie & MIP_MTIP) ||
+        t->mtimecmp <= mtime) {
+        return UINT64_MAX;
+    }
+    return t->mtimecmp - mtime;
+}
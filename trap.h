@@ -0,0 +1,77 @@
+#ifndef TRAP_H
+#define TRAP_H
+
+#include "types.h"
+#include "mmio.h"
+
+/* Machine-mode interrupts: the trap CSRs (riscv.h), mret, wfi and a
+   CLINT-style timer and software interrupt, memory-mapped outside guest
+   memory the way SiFive's CLINT is:
+     CLINT_MSIP      u32 bit 0 raises the machine software interrupt
+     CLINT_MTIMECMP  u64 the timer interrupt is pending while mtime >= it
+     CLINT_MTIME     u64 one tick per cycle, i.e. per retired instruction
+                     plus the cycles wfi skipped
+   Only interrupts trap. ecall keeps its emulator services, and exceptions
+   still halt the machine with a status. A trap sets mepc to the
+   interrupted PC, mcause to the interrupt bit and cause, and MPIE to MIE,
+   clears MIE and jumps to mtvec (plus 4 * cause if mtvec's mode is
+   vectored). mret undoes it. wfi with an enabled interrupt that is not yet
+   pending skips mtime ahead to mtimecmp instead of spinning, and is a nop
+   if nothing enabled could ever wake it.
+
+   Interrupts cost nothing per instruction: machine_run() asks
+   trap_horizon() how many instructions can run before one could become
+   pending and runs exactly that many, then trap_poll() takes it. Anything
+   that changes the answer early (a CSR write, mret, wfi, a CLINT store)
+   sets Processor.yield, which ends the run at the end of that
+   instruction. The CLINT is a device on the machine's bus (mmio.h). */
+
+/* register offsets from CLINT_BASE */
+#define CLINT_BASE 0x2000000
+#define CLINT_SIZE 0x10000
+#define CLINT_MSIP 0x0
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME 0xBFF8
+
+#define MSTATUS_MIE 0x8
+#define MSTATUS_MPIE 0x80
+/* reads as M, the only privilege mode */
+#define MSTATUS_MPP 0x1800
+
+#define INTERRUPT_SOFTWARE 3
+#define INTERRUPT_TIMER 7
+#define MIP_MSIP (1U << INTERRUPT_SOFTWARE)
+#define MIP_MTIP (1U << INTERRUPT_TIMER)
+#define MCAUSE_INTERRUPT 0x80000000U
+
+#define MTVEC_VECTORED 0x1
+
+static inline Double trap_mtime(const Processor *p, Double instret) {
+    return instret + p->trap.idle;
+}
+
+/* Every argument instret is the number of instructions retired before the
+   one that is executing. */
+
+/* Trap CSR access; both return 0 for any other CSR */
+int trap_read_csr(const Processor *, Word csr, Double instret, Register *value);
+int trap_write_csr(Processor *, Word csr, Register value);
+
+/* CLINT device callbacks; both return 0 if offset is not a register */
+int clint_load(void *, Processor *, Byte *, Word offset, Alignment,
+               Double instret, Word *value);
+int clint_store(void *, Processor *, Byte *, Word offset, Alignment,
+                Double instret, Word value);
+
+void trap_mret(Processor *);
+void trap_wfi(Processor *, Double instret);
+
+/* Takes the highest-priority interrupt that is pending and enabled, if
+   any, and clears yield. Returns 1 if it trapped. */
+int trap_poll(Processor *);
+
+/* Instructions that can retire before an interrupt could need taking,
+   assuming nothing sets yield meanwhile; UINT64_MAX if none can */
+Double trap_horizon(const Processor *);
+
+#endif
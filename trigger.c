@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trigger.h"
+#include "riscv.h"
+
+void trigger_init(Trigger *t) {
+    memset(t, 0, sizeof(*t));
+}
+
+/* "A:B", "A:" or "A", with A and B within limit */
+static int parse_range(const char *text, Double limit, Double *a, Double *b,
+                       int *has_b) {
+    char *end;
+
+    *a = strtoull(text, &end, 0);
+    *has_b = 0;
+    if (end == text || *a > limit) {
+        return -1;
+    }
+    if (*end == ':' && end[1] != '\0') {
+        text = end + 1;
+        *b = strtoull(text, &end, 0);
+        if (end == text || *b > limit || *b <= *a) {
+            return -1;
+        }
+        *has_b = 1;
+    } else if (*end == ':') {
+        end++;
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+int trigger_parse(Trigger *t, const char *spec) {
+    Double a, b = 0;
+    int has_b;
+
+    if (strncmp(spec, "pc=", 3) == 0) {
+        if (parse_range(spec + 3, MEMORY_SPACE, &a, &b, &has_b) != 0 || !has_b) {
+            return -1;
+        }
+        // a second range narrows the first
+        t->pc_lo = t->has_pc && t->pc_lo > a ? t->pc_lo : a;
+        t->pc_hi = t->has_pc && t->pc_hi < b ? t->pc_hi : b;
+        t->has_pc = 1;
+    } else if (strncmp(spec, "write=", 6) == 0) {
+        if (parse_range(spec + 6, MEMORY_SPACE - 1, &a, &b, &has_b) != 0 || has_b ||
+            t->has_watch) {
+            return -1;
+        }
+        t->has_watch = 1;
+        t->watch = a;
+    } else {
+        if (parse_range(spec, UINT64_MAX - 1, &a, &b, &has_b) != 0) {
+            return -1;
+        }
+        // so does a second window; an empty one traces nothing
+        if (a > t->start) {
+            t->start = a;
+        }
+        if (has_b && (!t->stop || b < t->stop)) {
+            t->stop = b > t->start ? b : t->start;
+        } else if (t->stop && t->stop < t->start) {
+            t->stop = t->start;
+        }
+    }
+    return 0;
+}
+
+void trigger_arm(Trigger *t, const Byte *memory) {
+    t->fired = 0;
+    if (t->has_watch) {
+        t->watched = memory[t->watch];
+    }
+}
+
+/* Did the instruction at pc write the watched byte? */
+static int wrote(Trigger *t, Address pc, const Processor *p, Byte *memory) {
+    Word bits, funct3;
+    Address address;
+
+    if (memory[t->watch] != t->watched) {
+        return 1;
+    }
+    if (pc > MEMORY_SPACE - 4) {
+        return 0;
+    }
+    bits = load(memory, pc, LENGTH_WORD);
+    funct3 = (bits >> 12) & 0x7;
+    if ((bits & 0x7F) != 0x23 || funct3 > 2) {
+        return 0;
+    }
+    // a store leaves its base register alone, so it still holds the base
+    address = p->R[(bits >> 15) & 0x1F] +
+              ((sWord)(bits & 0xFE000000) >> 20 | ((bits >> 7) & 0x1F));
+    return t->watch - address < (1U << funct3);
+}
+
+int trigger_check(Trigger *t, Double index, Address pc, const Processor *p,
+                  Byte *memory) {
+    if (trigger_watches(t) && wrote(t, pc, p, memory)) {
+        t->fired = 1;
+    }
+    if (t->has_watch && !t->fired) {
+        return 0;
+    }
+    if (index < t->start || (t->stop && index >= t->stop)) {
+        return 0;
+    }
+    return !t->has_pc || (pc >= t->pc_lo && pc < t->pc_hi);
+}
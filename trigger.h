@@ -0,0 +1,48 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include "types.h"
+
+/* Conditional tracing (-T). Each spec narrows which retired instructions
+   -r and -R record, and every condition given must hold:
+     N:M         instructions N to M - 1, counting from 0; M may be left out
+     pc=LO:HI    the instruction's own address is in [LO, HI)
+     write=ADDR  from the first instruction that writes the byte at ADDR on
+   Numbers are decimal or 0x hex. Repeated windows or pc ranges intersect;
+   there is only one watch, so a second write= is rejected. A write is a scalar store covering ADDR
+   or, for vector stores and bulk ecalls, a change of the byte. The window
+   alone needs no per-instruction check: the run goes untraced up to N and
+   after M. */
+
+typedef struct {
+    Double start;
+    Double stop; /* 0: no end */
+    int has_pc;
+    Address pc_lo;
+    Address pc_hi;
+    int has_watch;
+    Address watch;
+    int fired;
+    Byte watched; /* the byte at watch, to notice other writers */
+} Trigger;
+
+void trigger_init(Trigger *);
+
+/* Adds one spec; returns -1 if it is malformed */
+int trigger_parse(Trigger *, const char *spec);
+
+/* Call once the program is loaded, before the first instruction */
+void trigger_arm(Trigger *, const Byte *memory);
+
+/* Must every instruction be checked, not just those in the window? */
+static inline int trigger_watches(const Trigger *t) {
+    return t->has_watch && !t->fired;
+}
+
+/* Is instruction index, which was at pc, traced? Call it for every
+   retired instruction while trigger_watches(), since writes before the
+   window still arm the watch. */
+int trigger_check(Trigger *, Double index, Address pc, const Processor *,
+                  Byte *memory);
+
+#endif
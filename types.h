@@ -23,13 +23,70 @@ typedef Word Address; /* unsigned, 32-bit */
 /* A register value */
 typedef Word Register; /* unsigned 32-bit*/
 
-/* The processor data: 
-    32 registers
-    LO & HI special registers
-    PC program counter */
+struct BranchPredictor;
+struct MemTrace;
+struct SuperblockCache;
+
+/* Decoded instructions that write x0 write this slot instead, so x0 never
+   has to be re-zeroed after every instruction */
+#define REG_SINK 32
+
+/* Vector register file of the V extension subset (vector.h): 32 registers
+   of VLEN bits. A register group of LMUL > 1 is consecutive registers, so
+   it is one contiguous run of bytes. */
+#define VLEN 128
+#define VLENB (VLEN / 8)
+
+typedef struct {
+    _Alignas(VLENB) Byte v[32][VLENB];
+    Word vl;
+    Word vtype;
+} VectorRegisters;
+
+/* Machine-mode trap CSRs and the CLINT timer (trap.h). mtime is not
+   stored: it is instret plus the cycles wfi skipped while waiting. */
+typedef struct {
+    Word mstatus; /* only MIE and MPIE are kept */
+    Word mie;
+    Word mtvec;
+    Word mscratch;
+    Word mepc;
+    Word mcause;
+    Word mtval;
+    Word msip;
+    Double mtimecmp;
+    Double idle;
+} TrapState;
+
+/* The processor data, hot state first and cache-line aligned:
+    32 registers (two lines) then the x0 write sink
+    PC program counter
+    instret retired instructions (same line as sink and PC)
+    status 0 while running, otherwise why the machine halted (machine.h)
+    yield set by anything that may make an interrupt pending sooner, so the
+          run loop stops to look (trap.h)
+    time_base host clock reading the time CSR counts from
+    bpred optional branch predictor fed by branches and jumps (NULL if off)
+    memtrace optional recorder of guest loads and stores (NULL if off)
+    replay optional log the host-dependent inputs go to or come from
+    sb superblock cache, told about stores so it can drop stale code
+    mmio devices mapped outside guest memory (mmio.h), NULL for none
+    V vector registers, vl and vtype
+    trap machine-mode trap state */
 typedef struct {
-    Register R[32];
+    _Alignas(64) Register R[33];
     Register PC;
+    Double instret;
+    int status;
+    int yield;
+    Double time_base;
+    struct BranchPredictor *bpred;
+    struct MemTrace *memtrace;
+    struct Replay *replay;
+    struct SuperblockCache *sb;
+    struct MmioBus *mmio;
+    VectorRegisters V;
+    TrapState trap;
 } Processor;
 
 /* Possible lengths of data, and their lengths in bytes.
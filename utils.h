@@ -7,9 +7,14 @@
 #define JAL_FORMAT "jal\tx%d, %d\n"
 #define BRANCH_FORMAT "%s\tx%d, x%d, %d\n"
 #define ECALL_FORMAT "ecall\n"
+#define MRET_FORMAT "mret\n"
+#define WFI_FORMAT "wfi\n"
+#define CSR_FORMAT "%s\tx%d, %s, x%d\n"
+#define CSRI_FORMAT "%s\tx%d, %s, %d\n"
 
 int sign_extend_number(unsigned, unsigned);
 Instruction parse_instruction(uint32_t);
+int is_valid_opcode(Word);
 int get_branch_offset(Instruction);
 int get_jump_offset(Instruction);
 int get_store_offset(Instruction);
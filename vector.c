@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <string.h>
+#include "vector.h"
+#include "utils.h"
+#include "memtrace.h"
+#include "superblock.h"
+#include "machine.h"
+#include "riscv.h"
+
+/* Decoded form shared by execute_vector() and vector_format() */
+
+enum {
+    VK_SETVLI,
+    VK_SETIVLI,
+    VK_SETVL,
+    VK_LOAD,
+    VK_STORE,
+    VK_ARITH,
+    VK_REDUCE,
+    VK_MV_XS,
+    VK_MV_SX,
+};
+
+/* element-wise ops */
+enum { VOP_ADD, VOP_SUB, VOP_MUL, VOP_MACC, VOP_MOVE };
+
+/* reductions, numbered by their funct6 */
+enum { RED_SUM, RED_AND, RED_OR, RED_XOR, RED_MINU, RED_MIN, RED_MAXU, RED_MAX };
+
+/* the last source of an element-wise op: vs1, rs1 or simm5 */
+enum { OPERAND_V, OPERAND_X, OPERAND_I };
+
+typedef struct {
+    int kind;
+    int op;      /* VOP_* or RED_* */
+    int operand; /* OPERAND_* */
+    int eew;     /* memory ops: log2 of the element size in bytes */
+    int strided;
+    const char *name;
+} VectorOp;
+
+#define FIELD(bits, lo, n) (((bits) >> (lo)) & ((1U << (n)) - 1))
+
+/* log2 of LMUL (-3 to 3, -4 is reserved) and of the element size in bytes */
+#define VTYPE_LMUL(vtype) ((int)((vtype) & 0x7) - (((vtype) & 0x4) ? 8 : 0))
+#define VTYPE_SEW(vtype) ((int)(((vtype) >> 3) & 0x7))
+
+#define MASK_BIT(v, i) (((v)->v[0][(i) >> 3] >> ((i) & 7)) & 1)
+
+static int vector_decode(Word bits, VectorOp *op) {
+    static const char *const loads[2][3] = {
+        {"vle8.v", "vle16.v", "vle32.v"}, {"vlse8.v", "vlse16.v", "vlse32.v"}};
+    static const char *const stores[2][3] = {
+        {"vse8.v", "vse16.v", "vse32.v"}, {"vsse8.v", "vsse16.v", "vsse32.v"}};
+    static const char *const reductions[8] = {
+        "vredsum.vs", "vredand.vs", "vredor.vs", "vredxor.vs",
+        "vredminu.vs", "vredmin.vs", "vredmaxu.vs", "vredmax.vs"};
+    Word funct3 = FIELD(bits, 12, 3);
+    Word funct6 = bits >> 26;
+    Word vm = FIELD(bits, 25, 1);
+    Word rs1 = FIELD(bits, 15, 5);
+    Word rs2 = FIELD(bits, 20, 5);
+    Word mop = FIELD(bits, 26, 2);
+
+    memset(op, 0, sizeof(*op));
+    switch (bits & 0x7F) {
+        case 0x07:
+        case 0x27:
+            // widths 0, 5 and 6; no segments (nf), no mew, no indexed forms
+            op->eew = funct3 == 0x0 ? 0 : funct3 == 0x5 ? 1 : funct3 == 0x6 ? 2 : -1;
+            if (op->eew < 0 || (bits >> 28) != 0 ||
+                !(mop == 0x2 || (mop == 0x0 && rs2 == 0))) {
+                return 0;
+            }
+            op->strided = mop == 0x2;
+            op->kind = (bits & 0x7F) == 0x07 ? VK_LOAD : VK_STORE;
+            op->name = (op->kind == VK_LOAD ? loads : stores)[op->strided][op->eew];
+            return 1;
+        case 0x57:
+            break;
+        default:
+            return 0;
+    }
+
+    switch (funct3) {
+        case 0x7: // OPCFG
+            if ((bits >> 31) == 0) {
+                op->kind = VK_SETVLI;
+                op->name = "vsetvli";
+            } else if ((bits >> 30) == 0x3) {
+                op->kind = VK_SETIVLI;
+                op->name = "vsetivli";
+            } else if ((bits >> 25) == 0x40) {
+                op->kind = VK_SETVL;
+                op->name = "vsetvl";
+            } else {
+                return 0;
+            }
+            return 1;
+        case 0x0: // OPIVV
+        case 0x3: // OPIVI
+        case 0x4: // OPIVX
+            op->kind = VK_ARITH;
+            op->operand = funct3 == 0x0 ? OPERAND_V
+                        : funct3 == 0x4 ? OPERAND_X : OPERAND_I;
+            if (funct6 == 0x00) {
+                op->op = VOP_ADD;
+                op->name = "vadd";
+            } else if (funct6 == 0x02 && funct3 != 0x3) {
+                op->op = VOP_SUB;
+                op->name = "vsub";
+            } else if (funct6 == 0x17 && vm && rs2 == 0) {
+                op->op = VOP_MOVE;
+                op->name = "vmv.v";
+            } else {
+                return 0;
+            }
+            return 1;
+        case 0x2: // OPMVV
+        case 0x6: // OPMVX
+            if (funct6 == 0x25 || funct6 == 0x2d) {
+                op->kind = VK_ARITH;
+                op->op = funct6 == 0x25 ? VOP_MUL : VOP_MACC;
+                op->operand = funct3 == 0x2 ? OPERAND_V : OPERAND_X;
+                op->name = funct6 == 0x25 ? "vmul" : "vmacc";
+                return 1;
+            }
+            if (funct3 == 0x2 && funct6 <= RED_MAX) {
+                op->kind = VK_REDUCE;
+                op->op = funct6;
+                op->name = reductions[funct6];
+                return 1;
+            }
+            if (funct6 == 0x10 && vm && funct3 == 0x2 && rs1 == 0) {
+                op->kind = VK_MV_XS;
+                op->name = "vmv.x.s";
+                return 1;
+            }
+            if (funct6 == 0x10 && vm && funct3 == 0x6 && rs2 == 0) {
+                op->kind = VK_MV_SX;
+                op->name = "vmv.s.x";
+                return 1;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+int vector_valid(Word instruction_bits) {
+    VectorOp op;
+    return vector_decode(instruction_bits, &op);
+}
+
+/* A group of 2^lmul registers starts at a multiple of its size */
+static int aligned(Word reg, int lmul) {
+    return lmul <= 0 || (reg & ((1U << lmul) - 1)) == 0;
+}
+
+/* ELEN is 32, so there are no 64-bit elements and SEW/LMUL is at most 32;
+   anything else sets vill */
+static void set_vtype(VectorRegisters *v, Word vtype, Word avl) {
+    int lmul = VTYPE_LMUL(vtype), sew = VTYPE_SEW(vtype);
+    Word vlmax;
+
+    if ((vtype >> 8) != 0 || lmul == -4 || sew > 2 || sew - lmul > 2) {
+        v->vtype = VTYPE_VILL;
+        v->vl = 0;
+        return;
+    }
+    vlmax = ((Word)VLENB << (lmul + 3)) >> (sew + 3);
+    v->vtype = vtype;
+    v->vl = avl < vlmax ? avl : vlmax;
+}
+
+#define SELECT(m, x, y) (((x) & (m)) | ((y) & ~(m)))
+
+/* Element-wise ops and reductions for one SEW, on host vectors V that each
+   hold one vector register (S is the signed view, for min and max). The
+   register file is only ever accessed through these, hence may_alias. */
+#define SEW_OPS(bits)                                                          \
+typedef uint##bits##_t E##bits;                                                \
+typedef E##bits V##bits __attribute__((vector_size(VLENB), may_alias));        \
+typedef int##bits##_t S##bits __attribute__((vector_size(VLENB), may_alias));  \
+                                                                               \
+/* all-ones lanes for the active elements in register c of a group */          \
+static inline V##bits lanes##bits(const VectorRegisters *v, Word c, int vm) {  \
+    V##bits m;                                                                 \
+    Word k, i;                                                                 \
+    for (k = 0; k < VLENB / sizeof(E##bits); k++) {                            \
+        i = c * (VLENB / sizeof(E##bits)) + k;                                 \
+        m[k] = i < v->vl && (vm || MASK_BIT(v, i)) ? (E##bits)~0 : 0;          \
+    }                                                                          \
+    return m;                                                                  \
+}                                                                              \
+                                                                               \
+static void arith##bits(VectorRegisters *v, int op, Word vd, Word vs2,         \
+                        Word vs1, E##bits x, int scalar, int vm) {             \
+    const Word lanes = VLENB / sizeof(E##bits);                                \
+    V##bits *d = (V##bits *)v->v[vd];                                          \
+    const V##bits *a = (const V##bits *)v->v[vs1];                             \
+    const V##bits *b = (const V##bits *)v->v[vs2];                             \
+    V##bits s = (V##bits){0} + x, r;                                           \
+    Word c;                                                                    \
+                                                                               \
+    for (c = 0; c * lanes < v->vl; c++) {                                      \
+        if (!scalar) {                                                         \
+            s = a[c];                                                          \
+        }                                                                      \
+        switch (op) {                                                          \
+            case VOP_ADD: r = b[c] + s; break;                                 \
+            case VOP_SUB: r = b[c] - s; break;                                 \
+            case VOP_MUL: r = b[c] * s; break;                                 \
+            case VOP_MACC: r = d[c] + s * b[c]; break;                         \
+            default: r = s; break;                                             \
+        }                                                                      \
+        if (vm && (c + 1) * lanes <= v->vl) {                                  \
+            d[c] = r;                                                          \
+        } else {                                                               \
+            V##bits m = lanes##bits(v, c, vm);                                 \
+            d[c] = SELECT(m, r, d[c]);                                         \
+        }                                                                      \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline V##bits combine##bits(int op, V##bits x, V##bits y) {            \
+    switch (op) {                                                              \
+        case RED_SUM: return x + y;                                            \
+        case RED_AND: return x & y;                                            \
+        case RED_OR: return x | y;                                             \
+        case RED_XOR: return x ^ y;                                            \
+        case RED_MINU: return SELECT((V##bits)(x < y), x, y);                  \
+        case RED_MIN: return SELECT((V##bits)((S##bits)x < (S##bits)y), x, y); \
+        case RED_MAXU: return SELECT((V##bits)(x > y), x, y);                  \
+        default: return SELECT((V##bits)((S##bits)x > (S##bits)y), x, y);     \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+/* vd[0] = vs1[0] op the active elements of vs2, lane-parallel first */        \
+static void reduce##bits(VectorRegisters *v, int op, Word vd, Word vs2,        \
+                         Word vs1, int vm) {                                   \
+    const Word lanes = VLENB / sizeof(E##bits);                                \
+    const V##bits *b = (const V##bits *)v->v[vs2];                             \
+    E##bits identity = op == RED_AND || op == RED_MINU ? (E##bits)~0           \
+                     : op == RED_MIN ? (E##bits)((E##bits)~0 >> 1)            \
+                     : op == RED_MAX ? (E##bits)~((E##bits)~0 >> 1) : 0;       \
+    V##bits none = (V##bits){0} + identity, acc = none, r;                     \
+    Word c, k;                                                                 \
+                                                                               \
+    for (c = 0; c * lanes < v->vl; c++) {                                      \
+        if (vm && (c + 1) * lanes <= v->vl) {                                  \
+            acc = combine##bits(op, acc, b[c]);                                \
+        } else {                                                               \
+            V##bits m = lanes##bits(v, c, vm);                                 \
+            acc = combine##bits(op, acc, SELECT(m, b[c], none));               \
+        }                                                                      \
+    }                                                                          \
+    r = (V##bits){0} + ((const V##bits *)v->v[vs1])[0][0];                     \
+    for (k = 0; k < lanes; k++) {                                              \
+        r = combine##bits(op, r, (V##bits){0} + acc[k]);                       \
+    }                                                                          \
+    ((V##bits *)v->v[vd])[0][0] = r[0];                                        \
+}
+
+SEW_OPS(8)
+SEW_OPS(16)
+SEW_OPS(32)
+
+static int access_memory(const VectorOp *op, Word bits, Processor *p,
+                         Byte *memory) {
+    VectorRegisters *v = &p->V;
+    int store = op->kind == VK_STORE;
+    int emul = op->eew - VTYPE_SEW(v->vtype) + VTYPE_LMUL(v->vtype);
+    Word vd = FIELD(bits, 7, 5), vm = FIELD(bits, 25, 1);
+    Word size = 1U << op->eew;
+    Word base = p->R[FIELD(bits, 15, 5)];
+    Word stride = op->strided ? p->R[FIELD(bits, 20, 5)] : size;
+    Byte *group = v->v[vd];
+    Word i, address;
+
+    // the elements fill a register group of EEW/SEW * LMUL registers
+    if (emul < -3 || emul > 3 || !aligned(vd, emul) || (!store && !vm && vd == 0)) {
+        return MACHINE_INVALID_INSTRUCTION;
+    }
+
+    if (vm && stride == size && in_memory(base, v->vl * size)) {
+        for (i = 0; p->memtrace && i < v->vl; i++) {
+            memtrace_access(p, base + i * size, (Alignment)size, store);
+        }
+        if (store) {
+            memcpy(memory + base, group, v->vl * size);
+            memory_dirty(memory, base, v->vl * size);
+            sb_check_range(p->sb, base, v->vl * size);
+        } else {
+            memcpy(group, memory + base, v->vl * size);
+        }
+        return MACHINE_RUNNING;
+    }
+
+    // masked, strided or partly outside memory: element by element
+    for (i = 0; i < v->vl; i++) {
+        if (!vm && !MASK_BIT(v, i)) {
+            continue;
+        }
+        address = base + i * stride;
+        if (!in_memory(address, size)) {
+            printf(store ? "Bad Write. Address: 0x%08x\n"
+                         : "Bad Read. Address: 0x%08x\n", address);
+            return MACHINE_ACCESS_FAULT;
+        }
+        memtrace_access(p, address, (Alignment)size, store);
+        if (store) {
+            memcpy(memory + address, group + i * size, size);
+            memory_dirty(memory, address, size);
+            sb_check_store(p->sb, address, (Alignment)size);
+        } else {
+            memcpy(group + i * size, memory + address, size);
+        }
+    }
+    return MACHINE_RUNNING;
+}
+
+/* Returns MACHINE_RUNNING, or the status to halt with */
+static int run(const VectorOp *op, Word bits, Processor *p, Byte *memory) {
+    VectorRegisters *v = &p->V;
+    Word rd = FIELD(bits, 7, 5), rs1 = FIELD(bits, 15, 5);
+    Word rs2 = FIELD(bits, 20, 5), vm = FIELD(bits, 25, 1);
+    int sew = VTYPE_SEW(v->vtype), lmul = VTYPE_LMUL(v->vtype);
+    Word avl, x, element = 0;
+
+    if (op->kind == VK_SETVLI || op->kind == VK_SETIVLI || op->kind == VK_SETVL) {
+        if (op->kind == VK_SETIVLI) {
+            avl = rs1;
+        } else if (rs1 != 0) {
+            avl = p->R[rs1];
+        } else {
+            // rd = rs1 = x0 keeps vl, rs1 = x0 alone asks for VLMAX
+            avl = rd != 0 ? ~0U : v->vl;
+        }
+        set_vtype(v, op->kind == VK_SETVLI ? FIELD(bits, 20, 11)
+                   : op->kind == VK_SETIVLI ? FIELD(bits, 20, 10) : p->R[rs2],
+                  avl);
+        p->R[rd] = v->vl;
+        return MACHINE_RUNNING;
+    }
+    if (v->vtype & VTYPE_VILL) {
+        return MACHINE_INVALID_INSTRUCTION;
+    }
+
+    switch (op->kind) {
+        case VK_LOAD:
+        case VK_STORE:
+            return access_memory(op, bits, p, memory);
+        case VK_ARITH:
+            if (!aligned(rd, lmul) || (op->op != VOP_MOVE && !aligned(rs2, lmul)) ||
+                (op->operand == OPERAND_V && !aligned(rs1, lmul)) || (!vm && rd == 0)) {
+                return MACHINE_INVALID_INSTRUCTION;
+            }
+            x = op->operand == OPERAND_X ? p->R[rs1] : (Word)sign_extend_number(rs1, 5);
+            switch (sew) {
+                case 0: arith8(v, op->op, rd, rs2, rs1, x, op->operand != OPERAND_V, vm); break;
+                case 1: arith16(v, op->op, rd, rs2, rs1, x, op->operand != OPERAND_V, vm); break;
+                case 2: arith32(v, op->op, rd, rs2, rs1, x, op->operand != OPERAND_V, vm); break;
+            }
+            return MACHINE_RUNNING;
+        case VK_REDUCE:
+            if (!aligned(rs2, lmul)) {
+                return MACHINE_INVALID_INSTRUCTION;
+            }
+            if (v->vl == 0) {
+                return MACHINE_RUNNING; // vd is left alone
+            }
+            switch (sew) {
+                case 0: reduce8(v, op->op, rd, rs2, rs1, vm); break;
+                case 1: reduce16(v, op->op, rd, rs2, rs1, vm); break;
+                case 2: reduce32(v, op->op, rd, rs2, rs1, vm); break;
+            }
+            return MACHINE_RUNNING;
+        case VK_MV_XS:
+            // element 0, sign-extended; vl does not matter
+            memcpy(&element, v->v[rs2], 1U << sew);
+            p->R[rd] = sew < 2 ? (Word)sign_extend_number(element, 8U << sew) : element;
+            return MACHINE_RUNNING;
+        case VK_MV_SX:
+            if (v->vl > 0) {
+                memcpy(v->v[rd], &p->R[rs1], 1U << sew);
+            }
+            return MACHINE_RUNNING;
+    }
+    return MACHINE_INVALID_INSTRUCTION;
+}
+
+void execute_vector(Word instruction_bits, Processor *processor, Byte *memory) {
+    VectorOp op;
+    int status = MACHINE_INVALID_INSTRUCTION;
+
+    if (vector_decode(instruction_bits, &op)) {
+        status = run(&op, instruction_bits, processor, memory);
+    }
+    if (status == MACHINE_INVALID_INSTRUCTION) {
+        Instruction instruction;
+        instruction.bits = instruction_bits;
+        handle_invalid_instruction(instruction);
+    }
+    if (status != MACHINE_RUNNING) {
+        processor->status = status;
+    } else {
+        processor->PC += 4;
+    }
+}
+
+/* "e32, m1, ta, ma", or the number if any field is reserved */
+static void format_vtype(Word vtype, char *out, size_t size) {
+    static const char *const lmuls[8] = {"m1", "m2", "m4", "m8",
+                                         NULL, "mf8", "mf4", "mf2"};
+
+    if ((vtype >> 8) != 0 || (vtype & 0x7) == 0x4 || VTYPE_SEW(vtype) > 3) {
+        snprintf(out, size, "%u", vtype);
+        return;
+    }
+    snprintf(out, size, "e%d, %s, %s, %s", 8 << VTYPE_SEW(vtype),
+             lmuls[vtype & 0x7], (vtype & 0x40) ? "ta" : "tu",
+             (vtype & 0x80) ? "ma" : "mu");
+}
+
+int vector_format(Word instruction_bits, char *out, size_t size) {
+    static const char *const suffixes[2][3] = {{".vv", ".vx", ".vi"},
+                                               {".v", ".x", ".i"}};
+    Word bits = instruction_bits;
+    int rd = FIELD(bits, 7, 5), rs1 = FIELD(bits, 15, 5), rs2 = FIELD(bits, 20, 5);
+    const char *mask = FIELD(bits, 25, 1) ? "" : ", v0.t";
+    const char *suffix;
+    char text[32];
+    VectorOp op;
+
+    if (!vector_decode(bits, &op)) {
+        return 0;
+    }
+    switch (op.kind) {
+        case VK_SETVLI:
+            format_vtype(FIELD(bits, 20, 11), text, sizeof(text));
+            return snprintf(out, size, "%s\tx%d, x%d, %s", op.name, rd, rs1, text);
+        case VK_SETIVLI:
+            format_vtype(FIELD(bits, 20, 10), text, sizeof(text));
+            return snprintf(out, size, "%s\tx%d, %d, %s", op.name, rd, rs1, text);
+        case VK_SETVL:
+            return snprintf(out, size, "%s\tx%d, x%d, x%d", op.name, rd, rs1, rs2);
+        case VK_LOAD:
+        case VK_STORE:
+            if (op.strided) {
+                return snprintf(out, size, "%s\tv%d, (x%d), x%d%s", op.name, rd,
+                                rs1, rs2, mask);
+            }
+            return snprintf(out, size, "%s\tv%d, (x%d)%s", op.name, rd, rs1, mask);
+        case VK_ARITH:
+            suffix = suffixes[op.op == VOP_MOVE][op.operand];
+            if (op.operand == OPERAND_I) {
+                snprintf(text, sizeof(text), "%d", sign_extend_number(rs1, 5));
+            } else {
+                snprintf(text, sizeof(text), "%c%d",
+                         op.operand == OPERAND_V ? 'v' : 'x', rs1);
+            }
+            if (op.op == VOP_MOVE) {
+                return snprintf(out, size, "%s%s\tv%d, %s", op.name, suffix, rd, text);
+            }
+            if (op.op == VOP_MACC) {
+                return snprintf(out, size, "%s%s\tv%d, %s, v%d%s", op.name, suffix,
+                                rd, text, rs2, mask);
+            }
+            return snprintf(out, size, "%s%s\tv%d, v%d, %s%s", op.name, suffix, rd,
+                            rs2, text, mask);
+        case VK_REDUCE:
+            return snprintf(out, size, "%s\tv%d, v%d, v%d%s", op.name, rd, rs2,
+                            rs1, mask);
+        case VK_MV_XS:
+            return snprintf(out, size, "%s\tx%d, v%d", op.name, rd, rs2);
+        case VK_MV_SX:
+            return snprintf(out, size, "%s\tv%d, x%d", op.name, rd, rs1);
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* A subset of the V extension, roughly Zve32x with VLEN 128:
+     vsetvli, vsetivli, vsetvl   SEW 8, 16 or 32; LMUL 1/4 to 8
+     vle/vse, vlse/vsse          8, 16 and 32-bit elements, unit-stride
+                                 and strided
+     vadd, vsub                  .vv .vx; vadd also .vi
+     vmul, vmacc                 .vv .vx
+     vred{sum,and,or,xor,minu,min,maxu,max}.vs
+     vmv.v.{v,x,i}, vmv.x.s, vmv.s.x
+   All take v0.t masks where the spec allows them. Tails and masked-off
+   elements are left undisturbed, whatever vta and vma say.
+
+   Element-wise ops run on host vectors of VLENB bytes, one register of the
+   group at a time. Unit-stride accesses with no mask are a single memcpy
+   between guest memory and the register group, so the element layout in
+   a register is guest memory order: this assumes a little-endian host, as
+   load() and store() already do. An access outside guest memory halts
+   with MACHINE_ACCESS_FAULT after the elements before it completed. */
+
+/* vtype after reset, or after a vset* asked for an unsupported type */
+#define VTYPE_VILL 0x80000000U
+
+/* Is this (opcode 0x07, 0x27 or 0x57) one of the supported encodings?
+   vtype-dependent checks, e.g. register group alignment, happen as it runs */
+int vector_valid(Word instruction_bits);
+
+/* Executes a vector instruction, advancing the PC or setting the status */
+void execute_vector(Word instruction_bits, Processor *, Byte *memory);
+
+/* Writes the assembly text (no newline) and returns its length, or returns
+   0 if the encoding is not supported */
+int vector_format(Word instruction_bits, char *out, size_t size);
+
+#endif